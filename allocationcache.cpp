@@ -0,0 +1,201 @@
+#include "allocationcache.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QThread>
+
+#include "cowdetector.h"
+#include "sqlstatements.h"
+#include "metrics.h"
+
+/*
+ * Allocations are read on a dedicated thread with its own connection : a box never waits
+ * for the database at cow entry, a dead link only delays the refresh of the cached value.
+ */
+
+AllocationCache::AllocationCache(const QJsonObject &config, QObject *parent) :
+    QObject(parent)
+  , m_thread(new QThread)
+  , m_config(config)
+  , m_connectionName("allocations")
+{
+    qRegisterMetaType<FoodAllocation>();
+    m_thread->setObjectName("AllocationCache");
+    moveToThread(m_thread);
+}
+
+AllocationCache::~AllocationCache()
+{
+    stop();
+    delete m_thread;
+}
+
+void AllocationCache::start()
+{
+    m_thread->start();
+    QMetaObject::invokeMethod(this, "open", Qt::QueuedConnection);
+}
+
+void AllocationCache::stop()
+{
+    if (!m_thread->isRunning()) return;
+    QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
+    m_thread->quit();
+    m_thread->wait();
+}
+
+void AllocationCache::open()
+{
+    CowDetector::addDatabase(m_config, m_connectionName);
+}
+
+void AllocationCache::close()
+{
+    SqlStatements::release(m_connectionName);
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool AllocationCache::allocation(int cow, FoodAllocation *allocation)
+{
+    QMutexLocker locker(&m_mutex);
+    auto i = m_allocations.constFind(cow);
+    if (i == m_allocations.constEnd()) {
+        *allocation = FoodAllocation();
+        return false;
+    }
+    *allocation = *i;
+    return true;
+}
+
+void AllocationCache::refresh(int cow)
+{
+    QMetaObject::invokeMethod(this, "refreshCow", Qt::QueuedConnection, Q_ARG(int, cow));
+}
+
+void AllocationCache::refreshCow(int cow)
+{
+    // The main connection tells when the server is reachable, nothing is tried meanwhile
+    CowDetector* detector = CowDetector::instance();
+    if (detector && !detector->isDatabaseConnected()) return;
+    if (!reconnect()) return;
+
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    QSqlQuery* query = SqlStatements::prepared(db, "SELECT fooda, foodb, mealcount, mealdelay, eatspeed FROM foodallocation WHERE cow = :cow ORDER BY id DESC LIMIT 1");
+    query->bindValue(":cow", cow);
+    if (!SqlStatements::exec(query)) {
+        qWarning() << "[AllocationCache] foodallocation table query error : " << query->lastError().text();
+        db.close();             // Reopened at next refresh
+        return;
+    }
+
+    FoodAllocation allocation;
+    bool found = query->next();
+    if (found) allocation = fromQuery(*query, 0);
+    {
+        QMutexLocker locker(&m_mutex);
+        auto i = m_allocations.constFind(cow);
+        if (found ? (i != m_allocations.constEnd() && *i == allocation) : i == m_allocations.constEnd()) return;
+        if (found) m_allocations.insert(cow, allocation);
+        else m_allocations.remove(cow);
+    }
+    emit allocationChanged(cow, allocation);
+}
+
+bool AllocationCache::reconnect()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (db.isOpen()) return true;
+    if (m_reconnectTimer.isValid() && m_reconnectTimer.elapsed() < 20000) return false;
+    m_reconnectTimer.start();
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"allocations\"");
+    reconnects->add();
+
+    if (!db.open()) {
+        qWarning() << "[AllocationCache] Database connection error : " << db.lastError().text();
+        return false;
+    }
+    SqlStatements::opened(db);
+    return true;
+}
+
+bool AllocationCache::loadSnapshot(const QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT cow, fooda, foodb, mealcount, mealdelay, eatspeed FROM foodallocation")) {
+        qWarning() << "[AllocationCache] snapshot query error : " << query.lastError().text();
+        return false;
+    }
+
+    // Allocations already read from the database are newer
+    QMutexLocker locker(&m_mutex);
+    while (query.next()) {
+        int cow = query.value(0).toInt();
+        if (!m_allocations.contains(cow)) m_allocations.insert(cow, fromQuery(query, 1));
+    }
+    return true;
+}
+
+bool AllocationCache::saveSnapshot(const QSqlDatabase &db)
+{
+    QHash<int, FoodAllocation> allocations;
+    {
+        QMutexLocker locker(&m_mutex);
+        allocations = m_allocations;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM foodallocation")) {
+        qWarning() << "[AllocationCache] snapshot delete error : " << query.lastError().text();
+        return false;
+    }
+    query.prepare("INSERT INTO foodallocation (cow, fooda, foodb, mealcount, mealdelay, eatspeed) VALUES (?, ?, ?, ?, ?, ?)");
+    for (auto i = allocations.constBegin(); i != allocations.constEnd(); i++) {
+        query.addBindValue(i.key());
+        query.addBindValue(i->foodA);
+        query.addBindValue(i->foodB);
+        query.addBindValue(i->mealCount);
+        query.addBindValue(i->mealDelay);
+        query.addBindValue(i->eatSpeed);
+        if (!query.exec()) {
+            qWarning() << "[AllocationCache] snapshot insert error : " << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void AllocationCache::reload()
+{
+    if (!reconnect()) return;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT DISTINCT ON (cow) cow, fooda, foodb, mealcount, mealdelay, eatspeed FROM foodallocation ORDER BY cow, id DESC")) {
+        qWarning() << "[AllocationCache] foodallocation table query error : " << query.lastError().text();
+        db.close();
+        return;
+    }
+
+    QHash<int, FoodAllocation> allocations;
+    while (query.next()) allocations.insert(query.value(0).toInt(), fromQuery(query, 1));
+    QMutexLocker locker(&m_mutex);
+    m_allocations.swap(allocations);
+}
+
+FoodAllocation AllocationCache::fromQuery(const QSqlQuery &query, int first)
+{
+    FoodAllocation allocation;
+    allocation.foodA = query.value(first).toInt();
+    allocation.foodB = query.value(first + 1).toInt();
+    allocation.mealCount = query.value(first + 2).toInt();
+    allocation.mealDelay = query.value(first + 3).toInt();
+    allocation.eatSpeed = query.value(first + 4).toInt();
+    if (allocation.eatSpeed <= 0) allocation.eatSpeed = 6;
+    return allocation;
+}
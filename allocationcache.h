@@ -0,0 +1,74 @@
+#ifndef ALLOCATIONCACHE_H
+#define ALLOCATIONCACHE_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+class QSqlQuery;
+class QSqlDatabase;
+class QThread;
+
+struct FoodAllocation
+{
+    int foodA = 0;
+    int foodB = 0;
+    int mealCount = -1;
+    int mealDelay = -1;
+    int eatSpeed = 6;
+
+    bool operator==(const FoodAllocation &other) const {
+        return foodA == other.foodA && foodB == other.foodB && mealCount == other.mealCount
+                && mealDelay == other.mealDelay && eatSpeed == other.eatSpeed;
+    }
+    bool operator!=(const FoodAllocation &other) const { return !(*this == other); }
+};
+
+Q_DECLARE_METATYPE(FoodAllocation)
+
+class AllocationCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AllocationCache(const QJsonObject &config, QObject *parent = 0);
+    ~AllocationCache();
+
+    // Last known allocation, never waits for the database. Thread safe.
+    bool allocation(int cow, FoodAllocation *allocation);
+    // Read the cow again in the background, allocationChanged is emitted when it differs. Thread safe.
+    void refresh(int cow);
+
+    // Last known allocation of each cow, kept in the startup snapshot
+    bool loadSnapshot(const QSqlDatabase &db);
+    bool saveSnapshot(const QSqlDatabase &db);
+
+    void start();
+    void stop();
+
+signals:
+    void allocationChanged(int cow, const FoodAllocation &allocation);
+
+public slots:
+    void reload();
+
+private slots:
+    void open();
+    void close();
+    void refreshCow(int cow);
+
+private:
+    bool reconnect();
+    static FoodAllocation fromQuery(const QSqlQuery &query, int first);
+
+private:
+    QThread* m_thread;
+    QJsonObject m_config;
+    QString m_connectionName;
+    QElapsedTimer m_reconnectTimer;
+    QMutex m_mutex;
+    QHash<int, FoodAllocation> m_allocations;
+};
+
+#endif // ALLOCATIONCACHE_H
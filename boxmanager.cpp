@@ -0,0 +1,178 @@
+#include "boxmanager.h"
+
+#include <QJsonArray>
+#include <QThread>
+#include <QTimer>
+#include <QtDebug>
+
+#include "cowbox.h"
+
+/*
+ * Create the cow boxes from the configuration.
+ * With "boxThreads": N > 0 boxes are spread over a pool of N threads (one thread per box when N >= box count),
+ * each of them with its own database connection, detector and gpio objects.
+ * Default is 0 : all boxes live in the main thread.
+ * A new configuration only touches the boxes whose object changed, matched by "id". A box with
+ * a cow inside or food running is rebuilt or deleted once it is idle, its meal is not cut.
+ */
+
+static const int PendingRetryInterval = 5000;
+
+BoxManager::BoxManager(const QJsonObject &config, QObject *parent) :
+    QObject(parent)
+  , m_config(config)
+  , m_pendingTimer(new QTimer(this))
+{
+    m_pendingTimer->setInterval(PendingRetryInterval);
+    connect(m_pendingTimer, &QTimer::timeout, this, &BoxManager::applyPending);
+
+    auto boxArray = config.value("boxes").toArray();
+    int threadCount = qMin(config.value("boxThreads").toInt(0), boxArray.count());
+    for (int i = 0; i < threadCount; i++) {
+        QThread* thread = new QThread(this);
+        thread->setObjectName(QString("BoxThread%1").arg(i));
+        thread->start();
+        QObject* context = new QObject;
+        context->moveToThread(thread);
+        m_threads.append(thread);
+        m_contexts.append(context);
+    }
+    if (threadCount > 0) qDebug() << "[BoxManager] " << boxArray.count() << " boxes on " << threadCount << " threads.";
+
+    for (int i = 0; i < boxArray.count(); i++) {
+        QObject* context = m_contexts.isEmpty() ? nullptr : m_contexts.at(i % m_contexts.count());
+        QJsonObject boxConfig = boxArray.at(i).toObject();
+        CowBox* box = createBox(boxConfig, context);
+        m_boxes.append(box);
+        m_boxById.insert(boxConfig.value("id").toInt(), box);
+        m_boxConfigs.insert(boxConfig.value("id").toInt(), boxConfig);
+    }
+}
+
+BoxManager::~BoxManager()
+{
+    for (CowBox* box : m_boxes) deleteBox(box);
+    m_boxes.clear();
+
+    for (QObject* context : m_contexts) context->deleteLater();
+    for (QThread* thread : m_threads) {
+        thread->quit();
+        thread->wait();
+    }
+}
+
+void BoxManager::reconfigure(const QJsonObject &config)
+{
+    // Other settings are only read at start
+    QStringList restart;
+    for (const QString &key : m_config.keys() + config.keys()) {
+        if (key != "boxes" && !restart.contains(key) && m_config.value(key) != config.value(key)) restart.append(key);
+    }
+    if (!restart.isEmpty()) qWarning() << "[BoxManager] Changes applied at next restart only : " << restart;
+    m_config = config;
+
+    QMap<int, QJsonObject> wanted;
+    for (const QJsonValue &value : config.value("boxes").toArray()) {
+        QJsonObject boxConfig = value.toObject();
+        int id = boxConfig.value("id").toInt();
+        if (wanted.contains(id)) qWarning() << "[BoxManager] Box id used twice, the last one is kept : " << id;
+        wanted.insert(id, boxConfig);
+    }
+
+    for (int id : m_boxConfigs.keys()) {
+        if (!wanted.contains(id)) m_pending.insert(id, QJsonObject());
+    }
+    for (auto i = wanted.constBegin(); i != wanted.constEnd(); i++) {
+        if (m_boxConfigs.value(i.key()) != i.value()) m_pending.insert(i.key(), i.value());
+        else m_pending.remove(i.key());     // Back to the running configuration
+    }
+    applyPending();
+}
+
+void BoxManager::applyPending()
+{
+    for (auto i = m_pending.begin(); i != m_pending.end(); ) {
+        int id = i.key();
+        CowBox* box = m_boxById.value(id);
+        if (box && isBusy(box)) {
+            i++;
+            continue;
+        }
+
+        // A rebuilt box stays in its thread
+        QObject* context = box ? contextOf(box) : leastLoadedContext();
+        if (box) {
+            qDebug() << "[BoxManager] " << (i.value().isEmpty() ? "Remove" : "Rebuild") << " box " << id;
+            m_boxes.removeAll(box);
+            m_boxById.remove(id);
+            m_boxConfigs.remove(id);
+            deleteBox(box);
+        }
+        if (!i.value().isEmpty()) {
+            if (!box) qDebug() << "[BoxManager] Add box " << id;
+            box = createBox(i.value(), context);
+            m_boxes.append(box);
+            m_boxById.insert(id, box);
+            m_boxConfigs.insert(id, i.value());
+        }
+        i = m_pending.erase(i);
+    }
+
+    if (m_pending.isEmpty()) m_pendingTimer->stop();
+    else {
+        if (!m_pendingTimer->isActive()) qDebug() << "[BoxManager] Boxes busy, changed once idle : " << m_pending.keys();
+        m_pendingTimer->start();
+    }
+}
+
+CowBox* BoxManager::createBox(const QJsonObject &config, QObject *context)
+{
+    if (!context) return new CowBox(config, nullptr);
+
+    // Built inside its thread so timers, serial port and connection belong to it
+    CowBox* box = nullptr;
+    QMetaObject::invokeMethod(context, [&box, &config]() { box = new CowBox(config, nullptr); }, Qt::BlockingQueuedConnection);
+    return box;
+}
+
+void BoxManager::deleteBox(CowBox *box)
+{
+    QObject* context = contextOf(box);
+    if (!context) delete box;
+    else QMetaObject::invokeMethod(context, [box]() { delete box; }, Qt::BlockingQueuedConnection);
+}
+
+QObject* BoxManager::contextOf(CowBox *box) const
+{
+    for (QObject* context : m_contexts) {
+        if (context->thread() == box->thread()) return context;
+    }
+    return nullptr;
+}
+
+QObject* BoxManager::leastLoadedContext() const
+{
+    QObject* least = nullptr;
+    int leastCount = 0;
+    for (QObject* context : m_contexts) {
+        int count = 0;
+        for (CowBox* box : m_boxes) {
+            if (box->thread() == context->thread()) count++;
+        }
+        if (!least || count < leastCount) {
+            least = context;
+            leastCount = count;
+        }
+    }
+    return least;
+}
+
+bool BoxManager::isBusy(CowBox *box) const
+{
+    QObject* context = contextOf(box);
+    if (!context) return box->isBusy();
+
+    bool busy = false;
+    QMetaObject::invokeMethod(context, [&busy, box]() { busy = box->isBusy(); }, Qt::BlockingQueuedConnection);
+    return busy;
+}
@@ -0,0 +1,47 @@
+#ifndef BOXMANAGER_H
+#define BOXMANAGER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QList>
+#include <QMap>
+
+class QThread;
+class QTimer;
+class CowBox;
+
+class BoxManager : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BoxManager(const QJsonObject &config, QObject *parent = 0);
+    ~BoxManager();
+
+    QList<CowBox*> boxes() const { return m_boxes; }
+
+public slots:
+    // Builds, rebuilds or deletes only the boxes whose configuration changed
+    void reconfigure(const QJsonObject &config);
+
+private slots:
+    void applyPending();
+
+private:
+    CowBox* createBox(const QJsonObject &config, QObject *context);
+    void deleteBox(CowBox *box);
+    QObject* contextOf(CowBox *box) const;
+    QObject* leastLoadedContext() const;
+    bool isBusy(CowBox *box) const;
+
+private:
+    QJsonObject m_config;
+    QList<CowBox*> m_boxes;
+    QList<QThread*> m_threads;
+    QList<QObject*> m_contexts;                 // One object living in each thread to run calls there
+    QMap<int, CowBox*> m_boxById;
+    QMap<int, QJsonObject> m_boxConfigs;        // Running configuration by box id
+    QMap<int, QJsonObject> m_pending;           // Waiting for the box to be idle, empty to delete it
+    QTimer* m_pendingTimer;
+};
+
+#endif // BOXMANAGER_H
@@ -0,0 +1,35 @@
+#ifndef BOXPARAMETERS_H
+#define BOXPARAMETERS_H
+
+#include <QMetaType>
+#include <QTime>
+
+// Settings of a box from the box table
+struct BoxParameters
+{
+    QTime newDayTime = QTime(5, 0);         // 5 AM
+    QTime idleStart1;
+    QTime idleStop1;
+    QTime idleStart2;
+    QTime idleStop2;
+    qreal foodSpeedA = 0.0;                 // Unknown until read, no distribution at zero speed
+    qreal foodSpeedB = 0.0;
+    int calibrationTime = 120;              // 120s for box food calibration
+    int mealMinimum = 100;                  // 100gr food distribution at each detection
+    int detectionDelay = 30;                // 30s between connections of the cow
+
+    bool operator==(const BoxParameters &other) const {
+        return newDayTime == other.newDayTime
+                && idleStart1 == other.idleStart1 && idleStop1 == other.idleStop1
+                && idleStart2 == other.idleStart2 && idleStop2 == other.idleStop2
+                && foodSpeedA == other.foodSpeedA && foodSpeedB == other.foodSpeedB
+                && calibrationTime == other.calibrationTime
+                && mealMinimum == other.mealMinimum
+                && detectionDelay == other.detectionDelay;
+    }
+    bool operator!=(const BoxParameters &other) const { return !(*this == other); }
+};
+
+Q_DECLARE_METATYPE(BoxParameters)
+
+#endif // BOXPARAMETERS_H
@@ -0,0 +1,247 @@
+#include "boxparameterservice.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QTimer>
+
+#include "sqlstatements.h"
+
+/*
+ * Parameters of all boxes, loaded from the box table in one query.
+ * Boxes are updated as soon as Postgres notifies a change on the "box" channel,
+ * it needs this trigger on the database :
+ *
+ *   CREATE FUNCTION notify_box() RETURNS trigger AS $$
+ *   BEGIN NOTIFY box; RETURN NULL; END; $$ LANGUAGE plpgsql;
+ *   CREATE TRIGGER box_notify AFTER INSERT OR DELETE OR UPDATE OF newdaytime, idlestart1, idlestop1,
+ *   idlestart2, idlestop2, foodspeeda, foodspeedb, calibrationtime, mealminimum, detectiondelay ON box
+ *   FOR EACH STATEMENT EXECUTE PROCEDURE notify_box();
+ *
+ * The column list keeps the heartbeat (lastconnected) from notifying.
+ * Without the trigger (or when the subscription failed) the table is polled.
+ */
+
+static const char* NotificationChannel = "box";
+static const int NotifiedPollInterval = 10 * 60 * 1000;     // Safety reload when notifications are working
+static const int PollInterval = 60 * 1000;
+static const int HeartbeatInterval = 60 * 1000;
+
+BoxParameterService::BoxParameterService(QObject *parent) :
+    QObject(parent)
+  , m_pollTimer(new QTimer(this))
+  , m_heartbeatTimer(new QTimer(this))
+{
+    qRegisterMetaType<BoxParameters>();
+
+    m_pollTimer->setSingleShot(false);
+    m_pollTimer->setInterval(PollInterval);
+    connect(m_pollTimer, &QTimer::timeout, this, &BoxParameterService::reload);
+
+    m_heartbeatTimer->setSingleShot(false);
+    m_heartbeatTimer->setInterval(HeartbeatInterval);
+    connect(m_heartbeatTimer, &QTimer::timeout, this, &BoxParameterService::heartbeat);
+    m_heartbeatTimer->start();
+}
+
+BoxParameters BoxParameterService::registerBox(int box, const QString &name)
+{
+    QMutexLocker locker(&m_mutex);
+    m_boxes.insert(box, name);
+    if (m_parameters.contains(box)) return m_parameters.value(box);
+
+    // Not loaded yet or missing from the table, the row is created by the reload
+    QMetaObject::invokeMethod(this, "reload", Qt::QueuedConnection);
+    return BoxParameters();
+}
+
+void BoxParameterService::unregisterBox(int box)
+{
+    QMutexLocker locker(&m_mutex);
+    m_boxes.remove(box);
+}
+
+bool BoxParameterService::loadSnapshot(const QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT boxnumber, newdaytime, idlestart1, idlestop1, idlestart2, idlestop2, foodspeeda, foodspeedb, "
+                    "calibrationtime, mealminimum, detectiondelay FROM box")) {
+        qWarning() << "[BoxParameterService] snapshot query error : " << query.lastError().text();
+        return false;
+    }
+
+    // Times are kept as text, an empty one is a null time like in the box table
+    QMutexLocker locker(&m_mutex);
+    while (query.next()) {
+        if (m_parameters.contains(query.value(0).toInt())) continue;
+        BoxParameters box;
+        box.newDayTime = QTime::fromString(query.value(1).toString(), Qt::ISODate);
+        box.idleStart1 = QTime::fromString(query.value(2).toString(), Qt::ISODate);
+        box.idleStop1  = QTime::fromString(query.value(3).toString(), Qt::ISODate);
+        box.idleStart2 = QTime::fromString(query.value(4).toString(), Qt::ISODate);
+        box.idleStop2  = QTime::fromString(query.value(5).toString(), Qt::ISODate);
+        box.foodSpeedA = query.value(6).toReal();
+        box.foodSpeedB = query.value(7).toReal();
+        box.calibrationTime = query.value(8).toInt();
+        box.mealMinimum = query.value(9).toInt();
+        box.detectionDelay = query.value(10).toInt();
+        m_parameters.insert(query.value(0).toInt(), box);
+    }
+    return true;
+}
+
+bool BoxParameterService::saveSnapshot(const QSqlDatabase &db)
+{
+    QHash<int, BoxParameters> parameters;
+    {
+        QMutexLocker locker(&m_mutex);
+        parameters = m_parameters;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM box")) {
+        qWarning() << "[BoxParameterService] snapshot delete error : " << query.lastError().text();
+        return false;
+    }
+    query.prepare("INSERT INTO box (boxnumber, newdaytime, idlestart1, idlestop1, idlestart2, idlestop2, foodspeeda, foodspeedb, "
+                  "calibrationtime, mealminimum, detectiondelay) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    for (auto i = parameters.constBegin(); i != parameters.constEnd(); i++) {
+        query.addBindValue(i.key());
+        query.addBindValue(i->newDayTime.toString(Qt::ISODate));
+        query.addBindValue(i->idleStart1.toString(Qt::ISODate));
+        query.addBindValue(i->idleStop1.toString(Qt::ISODate));
+        query.addBindValue(i->idleStart2.toString(Qt::ISODate));
+        query.addBindValue(i->idleStop2.toString(Qt::ISODate));
+        query.addBindValue(i->foodSpeedA);
+        query.addBindValue(i->foodSpeedB);
+        query.addBindValue(i->calibrationTime);
+        query.addBindValue(i->mealMinimum);
+        query.addBindValue(i->detectionDelay);
+        if (!query.exec()) {
+            qWarning() << "[BoxParameterService] snapshot insert error : " << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void BoxParameterService::reload()
+{
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!db.isOpen()) return;
+    subscribe();
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT boxnumber, newdaytime, idlestart1, idlestop1, idlestart2, idlestop2, foodspeeda, foodspeedb, "
+                    "calibrationtime, mealminimum, detectiondelay FROM box")) {
+        qWarning() << "[BoxParameterService] box table query error : " << query.lastError().text();
+        return;
+    }
+
+    QHash<int, BoxParameters> parameters;
+    while (query.next()) {
+        BoxParameters box;
+        box.newDayTime = query.value(1).toTime();
+        box.idleStart1 = query.value(2).toTime();
+        box.idleStop1  = query.value(3).toTime();
+        box.idleStart2 = query.value(4).toTime();
+        box.idleStop2  = query.value(5).toTime();
+        box.foodSpeedA = query.value(6).toReal();
+        box.foodSpeedB = query.value(7).toReal();
+        box.calibrationTime = query.value(8).toInt();
+        box.mealMinimum = query.value(9).toInt();
+        box.detectionDelay = query.value(10).toInt();
+        parameters.insert(query.value(0).toInt(), box);
+    }
+
+    QHash<int, QString> boxes;
+    {
+        QMutexLocker locker(&m_mutex);
+        boxes = m_boxes;
+    }
+
+    // Create the rows of new boxes with default values
+    for (auto i = boxes.constBegin(); i != boxes.constEnd(); i++) {
+        if (parameters.contains(i.key())) continue;
+        BoxParameters box;
+        box.foodSpeedA = 7;
+        box.foodSpeedB = 7;
+        if (!m_readOnly) insertBox(i.key(), i.value(), box);
+        parameters.insert(i.key(), box);
+    }
+
+    QList<int> changed;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto i = parameters.constBegin(); i != parameters.constEnd(); i++) {
+            if (!m_parameters.contains(i.key()) || m_parameters.value(i.key()) != i.value()) changed.append(i.key());
+        }
+        m_parameters.swap(parameters);
+    }
+    for (int box : changed) emit parametersChanged(box, m_parameters.value(box));
+}
+
+void BoxParameterService::insertBox(int box, const QString &name, const BoxParameters &parameters)
+{
+    QSqlQuery query(QSqlDatabase::database());
+    query.prepare("INSERT INTO box (boxnumber, boxname, newdaytime, foodspeeda, foodspeedb) "
+                  "VALUES (:boxNumber, :boxName, :newDayTime, :foodSpeedA, :foodSpeedB)");
+    query.bindValue(":boxNumber",   box);
+    query.bindValue(":boxName",     name);
+    query.bindValue(":newDayTime",  parameters.newDayTime);
+    query.bindValue(":foodSpeedA",  parameters.foodSpeedA);
+    query.bindValue(":foodSpeedB",  parameters.foodSpeedB);
+    if (!query.exec()) qWarning() << "[BoxParameterService] box insert query error : " << query.lastError().text();
+}
+
+void BoxParameterService::heartbeat()
+{
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!db.isOpen() || m_readOnly) return;
+
+    QList<int> boxes;
+    {
+        QMutexLocker locker(&m_mutex);
+        boxes = m_boxes.keys();
+    }
+    if (boxes.isEmpty()) return;
+
+    // Fill last connected column of all boxes at once, the list is padded with its last box to 1, 4, 16... entries
+    int count = 1;
+    while (count < boxes.count()) count *= 4;
+    QString sql = "UPDATE box SET lastconnected = ? WHERE boxnumber IN (";
+    for (int i = 0; i < count; i++) sql += i == 0 ? "?" : ", ?";
+    sql += ")";
+
+    QSqlQuery* query = SqlStatements::prepared(db, sql);
+    query->bindValue(0, QDateTime::currentDateTime());
+    for (int i = 0; i < count; i++) query->bindValue(i + 1, boxes.at(qMin(i, boxes.count() - 1)));
+    if (!SqlStatements::exec(query)) qWarning() << "[BoxParameterService] box update last connected error : " << query->lastError().text();
+}
+
+void BoxParameterService::notificationReceived(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload)
+{
+    Q_UNUSED(source);
+    Q_UNUSED(payload);
+    if (name == NotificationChannel) reload();
+}
+
+void BoxParameterService::subscribe()
+{
+    QSqlDriver* driver = QSqlDatabase::database().driver();
+    if (!driver->hasFeature(QSqlDriver::EventNotifications)) {
+        if (!m_pollTimer->isActive()) m_pollTimer->start(PollInterval);
+        return;
+    }
+
+    // Subscriptions are lost when the connection is reopened
+    if (driver->subscribedToNotifications().contains(NotificationChannel)) return;
+    connect(driver, SIGNAL(notification(QString,QSqlDriver::NotificationSource,QVariant)),
+            this, SLOT(notificationReceived(QString,QSqlDriver::NotificationSource,QVariant)), Qt::UniqueConnection);
+    if (driver->subscribeToNotification(NotificationChannel)) m_pollTimer->start(NotifiedPollInterval);
+    else {
+        qWarning() << "[BoxParameterService] Impossible to subscribe to box notifications, polling table.";
+        m_pollTimer->start(PollInterval);
+    }
+}
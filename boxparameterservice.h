@@ -0,0 +1,54 @@
+#ifndef BOXPARAMETERSERVICE_H
+#define BOXPARAMETERSERVICE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QSqlDriver>
+
+#include "boxparameters.h"
+
+class QTimer;
+class QSqlDatabase;
+
+class BoxParameterService : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BoxParameterService(QObject *parent = 0);
+
+    // Thread safe, return the last known parameters of the box
+    BoxParameters registerBox(int box, const QString &name);
+    void unregisterBox(int box);
+
+    // Nothing is written to the box table, for replays and simulations
+    void setReadOnly(bool readOnly) { m_readOnly = readOnly; }
+
+    // Parameters of the startup snapshot, boxes start with them while the database is not reachable
+    bool loadSnapshot(const QSqlDatabase &db);
+    bool saveSnapshot(const QSqlDatabase &db);
+
+signals:
+    void parametersChanged(int box, const BoxParameters &parameters);
+
+public slots:
+    void reload();
+
+private slots:
+    void notificationReceived(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload);
+    void heartbeat();
+
+private:
+    void subscribe();
+    void insertBox(int box, const QString &name, const BoxParameters &parameters);
+
+private:
+    QMutex m_mutex;
+    QHash<int, QString> m_boxes;                    // Registered boxes with their name
+    QHash<int, BoxParameters> m_parameters;
+    QTimer* m_pollTimer;
+    QTimer* m_heartbeatTimer;
+    bool m_readOnly = false;
+};
+
+#endif // BOXPARAMETERSERVICE_H
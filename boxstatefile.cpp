@@ -0,0 +1,95 @@
+#include "boxstatefile.h"
+
+#include <QtDebug>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Layout : "CDBS", quint32 version, quint32 slot size, 4 reserved bytes, then two slots.
+ * A file of another version or slot size is reset, the state is then lost once.
+ */
+
+static const int HeaderSize = 16;
+static const char Magic[4] = { 'C', 'D', 'B', 'S' };
+
+BoxStateFile::BoxStateFile(const QString &fileName) :
+    m_file(fileName)
+{
+    qint64 size = HeaderSize + 2 * qint64(sizeof(Slot));
+    if (!m_file.open(QIODevice::ReadWrite) || (m_file.size() != size && !m_file.resize(size))) {
+        qWarning() << "[BoxStateFile] State file error : " << fileName << m_file.errorString();
+        return;
+    }
+    m_map = m_file.map(0, size);
+    if (!m_map) {
+        qWarning() << "[BoxStateFile] State map error : " << fileName << m_file.errorString();
+        return;
+    }
+
+    quint32 version = 0;
+    quint32 slotSize = 0;
+    memcpy(&version, m_map + 4, sizeof(version));
+    memcpy(&slotSize, m_map + 8, sizeof(slotSize));
+    if (memcmp(m_map, Magic, sizeof(Magic)) != 0 || version != Version || slotSize != sizeof(Slot)) {
+        memset(m_map, 0, size_t(size));
+        memcpy(m_map, Magic, sizeof(Magic));
+        version = Version;
+        slotSize = sizeof(Slot);
+        memcpy(m_map + 4, &version, sizeof(version));
+        memcpy(m_map + 8, &slotSize, sizeof(slotSize));
+        return;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        const Slot* s = slot(i);
+        if (s->crc == crc32(reinterpret_cast<const uchar*>(s), int(offsetof(Slot, crc)))) m_sequence = qMax(m_sequence, s->sequence);
+    }
+}
+
+BoxStateFile::~BoxStateFile()
+{
+    if (m_map) m_file.unmap(m_map);
+}
+
+bool BoxStateFile::read(BoxState *state) const
+{
+    if (!m_map) return false;
+
+    const Slot* last = nullptr;
+    for (int i = 0; i < 2; i++) {
+        const Slot* s = slot(i);
+        if (s->sequence == 0 || s->crc != crc32(reinterpret_cast<const uchar*>(s), int(offsetof(Slot, crc)))) continue;
+        if (!last || s->sequence > last->sequence) last = s;
+    }
+    if (!last) return false;
+    *state = last->state;
+    return true;
+}
+
+void BoxStateFile::write(const BoxState &state)
+{
+    if (!m_map) return;
+
+    // The older slot is overwritten, the other one stays complete meanwhile
+    m_sequence++;
+    Slot* s = slot(int(m_sequence % 2));
+    s->sequence = m_sequence;
+    s->state = state;
+    s->crc = crc32(reinterpret_cast<const uchar*>(s), int(offsetof(Slot, crc)));
+}
+
+BoxStateFile::Slot* BoxStateFile::slot(int index) const
+{
+    return reinterpret_cast<Slot*>(m_map + HeaderSize + index * int(sizeof(Slot)));
+}
+
+quint32 BoxStateFile::crc32(const uchar *data, int size)
+{
+    // Reflected CRC-32 (same as zlib), a few hundred bytes per write do not need a table
+    quint32 crc = 0xFFFFFFFF;
+    for (int i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
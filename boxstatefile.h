@@ -0,0 +1,56 @@
+#ifndef BOXSTATEFILE_H
+#define BOXSTATEFILE_H
+
+#include <QFile>
+
+#include "allocationcache.h"
+
+// Live state of a box, enough to go on with the visit after a restart
+struct BoxState
+{
+    qint64 mealId = 0;                      // 0 when no food given yet
+    qint64 entry = 0;                       // Milliseconds since epoch
+    qint64 lastSeen = 0;                    // Last tag read of the cow
+    double foodMealA = 0.0;
+    double foodMealB = 0.0;
+    qint32 cow = -1;
+    FoodAllocation allocation;
+};
+
+/*
+ * Small mapped file holding the state of one box, written at each state change.
+ * Two slots are written in turn with a sequence number and a CRC, a write cut by a crash
+ * leaves the previous slot. Mapped pages survive a crash of the process, not a power cut.
+ * Only used from the thread of the box.
+ */
+class BoxStateFile
+{
+public:
+    explicit BoxStateFile(const QString &fileName);
+    ~BoxStateFile();
+
+    bool isOpen() const { return m_map != nullptr; }
+
+    // Last complete state, false when there is none
+    bool read(BoxState *state) const;
+    void write(const BoxState &state);
+
+    static const quint32 Version = 1;
+
+private:
+    struct Slot {
+        quint64 sequence;
+        BoxState state;
+        quint32 crc;
+    };
+
+    static quint32 crc32(const uchar *data, int size);
+    Slot* slot(int index) const;
+
+private:
+    QFile m_file;
+    uchar* m_map = nullptr;
+    quint64 m_sequence = 0;
+};
+
+#endif // BOXSTATEFILE_H
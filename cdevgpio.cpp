@@ -0,0 +1,124 @@
+#include "cdevgpio.h"
+
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+/*
+ * Input GPIO on /dev/gpiochipN (uAPI v2, Linux 5.10 and later).
+ * The line is requested for both edges with the kernel debounce, each edge wakes the
+ * notifier with its kernel timestamp. Kernels without debounce support get a software one.
+ * Without the Raspberry Pi, a gpio-sim chip gives lines to test with :
+ *   modprobe gpio-sim, then create a bank in /sys/kernel/config/gpio-sim and set
+ *   "gpioChip" to its /dev/gpiochipN, edges are driven through its sysfs "pull" files.
+ */
+
+CdevGpio::CdevGpio(const QString &chip, int line, GpioInterface::PullType pullType, int debounce, QObject *parent) :
+    GpioInterface(GpioInterface::In, pullType, parent)
+  , m_line(line)
+{
+    if (!request(chip, debounce, true)) {
+        if (!request(chip, debounce, false)) return;
+
+        // Real hardware settles in real time, a simulated clock must not stretch the debounce
+        m_debounceTimer = new QTimer(this);
+        m_debounceTimer->setTimerType(Qt::PreciseTimer);
+        m_debounceTimer->setSingleShot(true);
+        m_debounceTimer->setInterval(debounce);
+        connect(m_debounceTimer, &QTimer::timeout, this, &CdevGpio::readValue);
+    }
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &CdevGpio::readEvents);
+    readValue();
+}
+
+CdevGpio::~CdevGpio()
+{
+    delete m_notifier;
+    if (m_fd >= 0) ::close(m_fd);
+}
+
+bool CdevGpio::request(const QString &chip, int debounce, bool kernelDebounce)
+{
+    int chipFd = ::open(chip.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (chipFd < 0) {
+        qWarning() << "[CdevGpio] Impossible to open " << chip << " : " << strerror(errno);
+        return false;
+    }
+
+    struct gpio_v2_line_request request;
+    memset(&request, 0, sizeof(request));
+    request.offsets[0] = m_line;
+    request.num_lines = 1;
+    strncpy(request.consumer, "cowdetector", sizeof(request.consumer) - 1);
+    request.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    if (pullType() == GpioInterface::PullUp) request.config.flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_UP;
+    else if (pullType() == GpioInterface::PullDown) request.config.flags |= GPIO_V2_LINE_FLAG_BIAS_PULL_DOWN;
+    else request.config.flags |= GPIO_V2_LINE_FLAG_BIAS_DISABLED;
+    if (kernelDebounce && debounce > 0) {
+        request.config.num_attrs = 1;
+        request.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+        request.config.attrs[0].attr.debounce_period_us = debounce * 1000;
+        request.config.attrs[0].mask = 1;
+    }
+
+    int result = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &request);
+    int error = errno;
+    ::close(chipFd);
+    if (result < 0) {
+        if (kernelDebounce) qDebug() << "[CdevGpio] Line " << m_line << " without kernel debounce : " << strerror(error);
+        else qWarning() << "[CdevGpio] Line " << m_line << " request failed : " << strerror(error);
+        return false;
+    }
+
+    m_fd = request.fd;
+    return true;
+}
+
+void CdevGpio::setGpioInternal(bool on)
+{
+    Q_UNUSED(on);
+}
+
+void CdevGpio::readEvents()
+{
+    struct gpio_v2_line_event events[16];
+    ssize_t size = ::read(m_fd, events, sizeof(events));
+    if (size < 0) {
+        if (errno != EAGAIN && errno != EINTR) qWarning() << "[CdevGpio] Line " << m_line << " read error : " << strerror(errno);
+        return;
+    }
+
+    for (int i = 0; i < int(size / sizeof(struct gpio_v2_line_event)); i++) {
+        m_lastEdgeTimestamp = qint64(events[i].timestamp_ns);
+        if (m_debounceTimer) m_debounceTimer->start();
+        else setLevel(events[i].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+    }
+}
+
+void CdevGpio::readValue()
+{
+    struct gpio_v2_line_values values;
+    memset(&values, 0, sizeof(values));
+    values.mask = 1;
+    if (ioctl(m_fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) < 0) {
+        qWarning() << "[CdevGpio] Line " << m_line << " value error : " << strerror(errno);
+        return;
+    }
+    setLevel(values.bits & 1);
+}
+
+// Input low is considered activated (pull high case), like the polled inputs
+void CdevGpio::setLevel(bool level)
+{
+    if (pullType() == GpioInterface::PullUp) setOn(!level);
+    else setOn(level);
+}
@@ -0,0 +1,41 @@
+#ifndef CDEVGPIO_H
+#define CDEVGPIO_H
+
+#include "gpiointerface.h"
+
+class QSocketNotifier;
+class QTimer;
+
+// Input line of the GPIO character device, changes come from kernel edge events instead of polling
+class CdevGpio : public GpioInterface
+{
+    Q_OBJECT
+
+public:
+    explicit CdevGpio(const QString &chip, int line, PullType pullType, int debounce, QObject* parent = nullptr);
+    ~CdevGpio();
+
+    bool isValid() const { return m_fd >= 0; }
+    qint64 lastEdgeTimestamp() const { return m_lastEdgeTimestamp; }     // Kernel monotonic clock, ns
+
+    // GpioInterface interface
+protected:
+    void setGpioInternal(bool on) override;
+
+private slots:
+    void readEvents();
+    void readValue();
+
+private:
+    bool request(const QString &chip, int debounce, bool kernelDebounce);
+    void setLevel(bool level);
+
+private:
+    int m_line;
+    int m_fd = -1;
+    QSocketNotifier* m_notifier = nullptr;
+    QTimer* m_debounceTimer = nullptr;          // Only when the kernel can't debounce, on the monotonic clock like the line
+    qint64 m_lastEdgeTimestamp = 0;
+};
+
+#endif // CDEVGPIO_H
@@ -0,0 +1,95 @@
+#include "clock.h"
+
+#include <QCoreApplication>
+#include <QTimer>
+
+Clock* Clock::m_instance = nullptr;
+
+Clock::Clock(QObject *parent) :
+    QObject(parent)
+{
+}
+
+Clock* Clock::instance()
+{
+    // Belongs to the main thread whatever the thread of the first caller, main() creates it early anyway
+    static SystemClock* systemClock = []() {
+        SystemClock* clock = new SystemClock;
+        if (QCoreApplication::instance()) clock->moveToThread(QCoreApplication::instance()->thread());
+        return clock;
+    }();
+    return m_instance ? m_instance : systemClock;
+}
+
+void Clock::setInstance(Clock *clock)
+{
+    m_instance = clock;
+}
+
+void Clock::singleShot(int ms, QObject *receiver, const char *member)
+{
+    ClockTimer* timer = new ClockTimer(receiver);
+    timer->setSingleShot(true);
+    connect(timer, SIGNAL(timeout()), receiver, member);
+    connect(timer, &ClockTimer::timeout, timer, &QObject::deleteLater);
+    timer->start(ms);
+}
+
+void Clock::fire(ClockTimer *timer)
+{
+    if (timer->m_singleShot) timer->m_active = false;
+    emit timer->timeout();
+}
+
+
+SystemClock::SystemClock(QObject *parent) :
+    Clock(parent)
+{
+}
+
+void SystemClock::schedule(ClockTimer *timer)
+{
+    if (!timer->m_timer) {
+        timer->m_timer = new QTimer(timer);
+        connect(timer->m_timer, &QTimer::timeout, timer, [this, timer]() { fire(timer); });
+    }
+    timer->m_timer->setSingleShot(timer->m_singleShot);
+    timer->m_timer->start(timer->m_interval);
+}
+
+void SystemClock::cancel(ClockTimer *timer)
+{
+    if (timer->m_timer) timer->m_timer->stop();
+}
+
+
+ClockTimer::ClockTimer(QObject *parent) :
+    QObject(parent)
+  , m_clock(Clock::instance())
+{
+}
+
+ClockTimer::~ClockTimer()
+{
+    if (m_active) m_clock->cancel(this);
+}
+
+void ClockTimer::start()
+{
+    if (m_active) m_clock->cancel(this);
+    m_active = true;
+    m_clock->schedule(this);
+}
+
+void ClockTimer::start(int ms)
+{
+    m_interval = ms;
+    start();
+}
+
+void ClockTimer::stop()
+{
+    if (!m_active) return;
+    m_active = false;
+    m_clock->cancel(this);
+}
@@ -0,0 +1,97 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QPair>
+
+class QTimer;
+class ClockTimer;
+
+// Time source and timers of the feeding logic, the simulated one runs days in seconds
+class Clock : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Clock(QObject *parent = 0);
+
+    // Process wide, the system clock unless another one was set before any box is created.
+    // Called first from main(), before the box threads start.
+    static Clock* instance();
+    static void setInstance(Clock *clock);
+
+    virtual QDateTime now() const = 0;
+
+    static void singleShot(int ms, QObject *receiver, const char *member);
+    template <typename Functor>
+    static void singleShot(int ms, QObject *context, Functor functor);
+
+protected:
+    friend class ClockTimer;
+    virtual void schedule(ClockTimer *timer) = 0;
+    virtual void cancel(ClockTimer *timer) = 0;
+    void fire(ClockTimer *timer);
+
+private:
+    static Clock* m_instance;
+};
+
+class SystemClock : public Clock
+{
+    Q_OBJECT
+public:
+    explicit SystemClock(QObject *parent = 0);
+
+    QDateTime now() const override { return QDateTime::currentDateTime(); }
+
+protected:
+    void schedule(ClockTimer *timer) override;
+    void cancel(ClockTimer *timer) override;
+};
+
+// Same use as a QTimer, driven by the process clock
+class ClockTimer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ClockTimer(QObject *parent = 0);
+    ~ClockTimer();
+
+    void setInterval(int ms) { m_interval = ms; }
+    int interval() const { return m_interval; }
+    void setSingleShot(bool singleShot) { m_singleShot = singleShot; }
+    bool isSingleShot() const { return m_singleShot; }
+    bool isActive() const { return m_active; }
+
+signals:
+    void timeout();
+
+public slots:
+    void start();
+    void start(int ms);
+    void stop();
+
+private:
+    friend class Clock;
+    friend class SystemClock;
+    friend class SimulatedClock;
+
+    Clock* m_clock;
+    int m_interval = 0;
+    bool m_singleShot = false;
+    bool m_active = false;
+    QTimer* m_timer = nullptr;              // System clock only
+    QPair<qint64, quint64> m_deadline;      // Simulated clock only, ms since epoch and start order
+};
+
+template <typename Functor>
+void Clock::singleShot(int ms, QObject *context, Functor functor)
+{
+    ClockTimer* timer = new ClockTimer(context);
+    timer->setSingleShot(true);
+    connect(timer, &ClockTimer::timeout, context, functor);
+    connect(timer, &ClockTimer::timeout, timer, &QObject::deleteLater);
+    timer->start(ms);
+}
+
+#endif // CLOCK_H
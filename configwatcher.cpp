@@ -0,0 +1,108 @@
+#include "configwatcher.h"
+
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QTimer>
+#include <QtDebug>
+
+#ifndef Q_OS_WIN
+#include <signal.h>
+#endif
+
+#include "presencetracker.h"
+#include "hardwarefactory.h"
+#include "detectorregistry.h"
+#include "signalnotifier.h"
+
+/*
+ * Editors often write a new file and rename it over the old one, the watch is then lost
+ * and has to be set again. Several events come for one save, they are gathered by a short delay.
+ */
+
+static const int DebounceDelay = 500;
+
+ConfigWatcher::ConfigWatcher(const QString &fileName, QObject *parent) :
+    QObject(parent)
+  , m_fileName(fileName)
+  , m_watcher(new QFileSystemWatcher(this))
+  , m_debounce(new QTimer(this))
+  , m_config(read(fileName))
+{
+    m_debounce->setSingleShot(true);
+    m_debounce->setInterval(DebounceDelay);
+    connect(m_debounce, &QTimer::timeout, this, &ConfigWatcher::reload);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &ConfigWatcher::fileChanged);
+    if (!m_watcher->addPath(m_fileName)) qWarning() << "[ConfigWatcher] Can't watch " << m_fileName;
+
+#ifndef Q_OS_WIN
+    connect(new SignalNotifier(SIGHUP, this), &SignalNotifier::activated, this, &ConfigWatcher::signalReceived);
+#endif
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+}
+
+QJsonObject ConfigWatcher::read(const QString &fileName, QString *error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = file.errorString();
+        return QJsonObject();
+    }
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+    if (document.isNull() || !document.isObject()) {
+        if (error) *error = document.isNull() ? parseError.errorString() : QString("not a JSON object");
+        return QJsonObject();
+    }
+
+    QJsonObject config = document.object();
+    for (const QJsonValue &box : config.value("boxes").toArray()) {
+        QJsonObject detector = box.toObject().value("detector").toObject();
+        if (!HardwareFactory::isSimulated(config) && !DetectorRegistry::isKnownType(detector)) {
+            if (error) *error = QString("box %1 detector : unknown type %2, known types : %3").arg(box.toObject().value("id").toInt())
+                    .arg(detector.value("type").toString(), DetectorRegistry::types().join(", "));
+            return QJsonObject();
+        }
+        QString presenceError;
+        if (!PresenceTracker::isValidConfig(config, box.toObject().value("presence").toObject(), &presenceError)) {
+            if (error) *error = QString("box %1 presence : %2").arg(box.toObject().value("id").toInt()).arg(presenceError);
+            return QJsonObject();
+        }
+    }
+    return config;
+}
+
+void ConfigWatcher::fileChanged()
+{
+    m_debounce->start();
+}
+
+void ConfigWatcher::reload()
+{
+    // Watch again a replaced file
+    if (!m_watcher->files().contains(m_fileName) && !m_watcher->addPath(m_fileName)) {
+        qWarning() << "[ConfigWatcher] Can't watch " << m_fileName;
+    }
+
+    QString error;
+    QJsonObject config = read(m_fileName, &error);
+    if (config.isEmpty()) {
+        qWarning() << "[ConfigWatcher] Configuration not applied, error reading " << m_fileName << " : " << error;
+        return;
+    }
+    if (config == m_config) return;
+
+    qDebug() << "[ConfigWatcher] Configuration changed : " << m_fileName;
+    m_config = config;
+    emit configChanged(config);
+}
+
+void ConfigWatcher::signalReceived()
+{
+    qDebug() << "[ConfigWatcher] SIGHUP, reading " << m_fileName;
+    m_debounce->start();
+}
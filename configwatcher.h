@@ -0,0 +1,36 @@
+#ifndef CONFIGWATCHER_H
+#define CONFIGWATCHER_H
+
+#include <QObject>
+#include <QJsonObject>
+
+class QFileSystemWatcher;
+class QTimer;
+
+// Reads the configuration file again when it is written or on SIGHUP, an invalid file is ignored
+class ConfigWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ConfigWatcher(const QString &fileName, QObject *parent = 0);
+    ~ConfigWatcher();
+
+    // Null object and error set when the file can't be read or parsed, or has settings which can't work together
+    static QJsonObject read(const QString &fileName, QString *error = nullptr);
+
+signals:
+    void configChanged(const QJsonObject &config);
+
+private slots:
+    void fileChanged();
+    void reload();
+    void signalReceived();
+
+private:
+    QString m_fileName;
+    QFileSystemWatcher* m_watcher;
+    QTimer* m_debounce;
+    QJsonObject m_config;
+};
+
+#endif // CONFIGWATCHER_H
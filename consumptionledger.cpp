@@ -0,0 +1,305 @@
+#include "consumptionledger.h"
+
+#include <QtSql>
+#include <QtDebug>
+
+#include "cowdetector.h"
+#include "databasewriter.h"
+#include "clock.h"
+
+/*
+ * Process wide food consumption of each cow, shared by all boxes.
+ * Seeded from the meals table and updated in memory at each food distribution.
+ * A meal counts in a window when its entry time is inside, like the SUM queries it replaces.
+ */
+
+static const int HistoryHours = 24;         // Longest window kept in memory
+
+ConsumptionLedger::ConsumptionLedger(QObject *parent) :
+    QObject(parent)
+  , m_newDayTimer(new ClockTimer(this))
+{
+    m_dayStart = dayStart(m_newDayTime, Clock::instance()->now());
+    m_newDayTimer->setSingleShot(true);
+    connect(m_newDayTimer, &ClockTimer::timeout, this, &ConsumptionLedger::newDay);
+    scheduleNewDay();
+}
+
+QDateTime ConsumptionLedger::dayStart(const QTime &newDayTime, const QDateTime &now)
+{
+    // When the new day time is not yet passed, we have to check against previous day.
+    QDate startDate = now.date();
+    if (now.time() < newDayTime) startDate = startDate.addDays(-1);
+    return QDateTime(startDate, newDayTime);
+}
+
+void ConsumptionLedger::setNewDayTime(const QTime &newDayTime)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!newDayTime.isValid() || newDayTime == m_newDayTime) return;
+    m_newDayTime = newDayTime;
+
+    // The day change is done in the ledger thread
+    QMetaObject::invokeMethod(this, "newDay", Qt::QueuedConnection);
+}
+
+void ConsumptionLedger::eatenToday(int cow, const QDateTime &dayStart, qreal *foodA, qreal *foodB)
+{
+    QMutexLocker locker(&m_mutex);
+    if (dayStart != m_dayStart) {
+        sumSince(cow, dayStart, foodA, foodB);
+        return;
+    }
+
+    auto i = m_cows.constFind(cow);
+    *foodA = i == m_cows.constEnd() ? 0.0 : i->todayA;
+    *foodB = i == m_cows.constEnd() ? 0.0 : i->todayB;
+}
+
+void ConsumptionLedger::eatenSince(int cow, const QDateTime &since, qreal *foodA, qreal *foodB)
+{
+    QMutexLocker locker(&m_mutex);
+    sumSince(cow, since, foodA, foodB);
+}
+
+void ConsumptionLedger::addDispense(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        add(cow, mealEntry, foodA, foodB);
+    }
+    emit dispensed(cow, mealEntry, foodA, foodB);
+}
+
+void ConsumptionLedger::reconcile(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB)
+{
+    qreal missingA = 0.0;
+    qreal missingB = 0.0;
+    {
+        QMutexLocker locker(&m_mutex);
+        CowLedger &ledger = m_cows[cow];
+        const QVector<Meal> &meals = ledger.meals;
+        if (!meals.isEmpty() && meals.last().entry > mealEntry) {
+            qWarning() << "[ConsumptionLedger] Cow " << cow << " has meals after " << mealEntry << ", not reconciled";
+            return;
+        }
+        if (!meals.isEmpty() && meals.last().entry == mealEntry) {
+            int count = meals.count();
+            missingA = foodA - meals.last().cumulativeA + (count > 1 ? meals.at(count - 2).cumulativeA : 0.0);
+            missingB = foodB - meals.last().cumulativeB + (count > 1 ? meals.at(count - 2).cumulativeB : 0.0);
+        }
+        else {
+            missingA = foodA;
+            missingB = foodB;
+        }
+        if (qAbs(missingA) < 0.001 && qAbs(missingB) < 0.001) return;
+        add(cow, mealEntry, missingA, missingB);
+    }
+    emit dispensed(cow, mealEntry, missingA, missingB);
+}
+
+bool ConsumptionLedger::loadSnapshot(const QSqlDatabase &db)
+{
+    QDateTime since;
+    {
+        QMutexLocker locker(&m_mutex);
+        since = qMin(m_dayStart, Clock::instance()->now().addSecs(-HistoryHours * 3600));
+    }
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare("SELECT cow, entry, fooda, foodb FROM meals WHERE entry > ? ORDER BY entry");
+    query.addBindValue(since.toMSecsSinceEpoch());
+    if (!query.exec()) {
+        qWarning() << "[ConsumptionLedger] snapshot query error : " << query.lastError().text();
+        return false;
+    }
+
+    // Not seeded, the database reload still replaces it
+    QMutexLocker locker(&m_mutex);
+    m_snapshotLoaded = true;
+    if (m_seeded || !m_cows.isEmpty()) return true;
+    while (query.next()) {
+        add(query.value(0).toInt(), QDateTime::fromMSecsSinceEpoch(query.value(1).toLongLong()), query.value(2).toReal(), query.value(3).toReal());
+    }
+    return true;
+}
+
+bool ConsumptionLedger::saveSnapshot(const QSqlDatabase &db)
+{
+    QHash<int, CowLedger> cows;
+    {
+        QMutexLocker locker(&m_mutex);
+        cows = m_cows;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM meals")) {
+        qWarning() << "[ConsumptionLedger] snapshot delete error : " << query.lastError().text();
+        return false;
+    }
+
+    // Meals are kept as running sums, each row is the difference with the previous one
+    query.prepare("INSERT INTO meals (cow, entry, fooda, foodb) VALUES (?, ?, ?, ?)");
+    for (auto i = cows.constBegin(); i != cows.constEnd(); i++) {
+        qreal previousA = 0.0;
+        qreal previousB = 0.0;
+        for (const Meal &meal : i->meals) {
+            query.addBindValue(i.key());
+            query.addBindValue(meal.entry.toMSecsSinceEpoch());
+            query.addBindValue(meal.cumulativeA - previousA);
+            query.addBindValue(meal.cumulativeB - previousB);
+            if (!query.exec()) {
+                qWarning() << "[ConsumptionLedger] snapshot insert error : " << query.lastError().text();
+                return false;
+            }
+            previousA = meal.cumulativeA;
+            previousB = meal.cumulativeB;
+        }
+    }
+    return true;
+}
+
+void ConsumptionLedger::sumSince(int cow, const QDateTime &since, qreal *foodA, qreal *foodB)
+{
+    *foodA = 0.0;
+    *foodB = 0.0;
+    auto i = m_cows.find(cow);
+    if (i == m_cows.end() || i->meals.isEmpty()) return;
+
+    // Move the cursor to the first meal entered after since, usually zero or one step
+    const QVector<Meal> &meals = i->meals;
+    int cursor = qBound(0, i->cursor, meals.count());
+    while (cursor < meals.count() && meals.at(cursor).entry <= since) cursor++;
+    while (cursor > 0 && meals.at(cursor - 1).entry > since) cursor--;
+    i->cursor = cursor;
+    if (cursor == meals.count()) return;
+
+    const Meal &last = meals.last();
+    *foodA = last.cumulativeA;
+    *foodB = last.cumulativeB;
+    if (cursor > 0) {
+        *foodA -= meals.at(cursor - 1).cumulativeA;
+        *foodB -= meals.at(cursor - 1).cumulativeB;
+    }
+}
+
+void ConsumptionLedger::add(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB)
+{
+    CowLedger &ledger = m_cows[cow];
+    QVector<Meal> &meals = ledger.meals;
+
+    // Usually the last meal, a corrected meal can be an older one
+    int index = meals.count();
+    while (index > 0 && meals.at(index - 1).entry > mealEntry) index--;
+    if (index == 0 || meals.at(index - 1).entry != mealEntry) {
+        Meal meal;
+        meal.entry = mealEntry;
+        meal.cumulativeA = index > 0 ? meals.at(index - 1).cumulativeA : 0.0;
+        meal.cumulativeB = index > 0 ? meals.at(index - 1).cumulativeB : 0.0;
+        meals.insert(index, meal);
+        index++;
+    }
+
+    // Running sums of the meal and all the later ones include the food
+    for (int i = index - 1; i < meals.count(); i++) {
+        meals[i].cumulativeA += foodA;
+        meals[i].cumulativeB += foodB;
+    }
+
+    if (mealEntry > m_dayStart) {
+        ledger.todayA += foodA;
+        ledger.todayB += foodB;
+    }
+}
+
+void ConsumptionLedger::reload()
+{
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!db.isOpen()) return;
+
+    QDateTime since;
+    {
+        QMutexLocker locker(&m_mutex);
+        since = qMin(m_dayStart, Clock::instance()->now().addSecs(-HistoryHours * 3600));
+    }
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    query.prepare("SELECT cow, entry, fooda, foodb FROM meals WHERE entry > :starttime AND entry <= :now ORDER BY entry");
+    query.bindValue(":starttime", since);
+    query.bindValue(":now", Clock::instance()->now());
+    if (!query.exec()) {
+        qWarning() << "[ConsumptionLedger] meals query error : " << query.lastError().text();
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_cows.clear();
+    while (query.next()) {
+        add(query.value(0).toInt(), query.value(1).toDateTime(), query.value(2).toReal(), query.value(3).toReal());
+    }
+    m_seeded = true;
+    locker.unlock();
+    emit reloaded();
+}
+
+void ConsumptionLedger::newDay()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_dayStart = dayStart(m_newDayTime, Clock::instance()->now());
+    }
+    scheduleNewDay();
+
+    // Reseed from database so meals given by other hosts are counted, keep memory when it is not available,
+    // meals given offline are not replayed yet or meals are not written at all
+    DatabaseWriter* writer = CowDetector::instance()->writer();
+    if (QSqlDatabase::database(QSqlDatabase::defaultConnection, false).isOpen() && !writer->hasBacklog() && !writer->isReadOnly()) reload();
+    else {
+        QMutexLocker locker(&m_mutex);
+        prune();
+    }
+}
+
+void ConsumptionLedger::scheduleNewDay()
+{
+    QDateTime next = m_dayStart.addDays(1);
+    m_newDayTimer->start(qMax(qint64(1000), Clock::instance()->now().msecsTo(next)));
+}
+
+void ConsumptionLedger::prune()
+{
+    QDateTime since = qMin(m_dayStart, Clock::instance()->now().addSecs(-HistoryHours * 3600));
+    for (auto i = m_cows.begin(); i != m_cows.end(); ) {
+        QVector<Meal> meals = i->meals;
+        i->meals.clear();
+        i->todayA = 0.0;
+        i->todayB = 0.0;
+        i->cursor = 0;
+
+        // Rebuild running sums and day totals from the meals still in history
+        qreal previousA = 0.0;
+        qreal previousB = 0.0;
+        for (const Meal &meal : meals) {
+            qreal foodA = meal.cumulativeA - previousA;
+            qreal foodB = meal.cumulativeB - previousB;
+            previousA = meal.cumulativeA;
+            previousB = meal.cumulativeB;
+            if (meal.entry <= since) continue;
+            Meal kept = meal;
+            kept.cumulativeA = foodA;
+            kept.cumulativeB = foodB;
+            if (!i->meals.isEmpty()) {
+                kept.cumulativeA += i->meals.last().cumulativeA;
+                kept.cumulativeB += i->meals.last().cumulativeB;
+            }
+            i->meals.append(kept);
+            if (meal.entry > m_dayStart) {
+                i->todayA += foodA;
+                i->todayB += foodB;
+            }
+        }
+
+        if (i->meals.isEmpty()) i = m_cows.erase(i);
+        else i++;
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef CONSUMPTIONLEDGER_H
+#define CONSUMPTIONLEDGER_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <QVector>
+#include <QMutex>
+#include <atomic>
+
+class ClockTimer;
+class QSqlDatabase;
+
+class ConsumptionLedger : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ConsumptionLedger(QObject *parent = 0);
+
+    static QDateTime dayStart(const QTime &newDayTime, const QDateTime &now);
+
+    // Thread safe, shared by all boxes
+    void setNewDayTime(const QTime &newDayTime);
+    bool isSeeded() const { return m_seeded.load(); }
+    // Seeded from the database or the startup snapshot, eaten food is unknown otherwise
+    bool hasHistory() const { return m_seeded.load() || m_snapshotLoaded.load(); }
+
+    // Food given in meals entered after the given time (same semantic as the meals table entry column)
+    void eatenToday(int cow, const QDateTime &dayStart, qreal *foodA, qreal *foodB);
+    void eatenSince(int cow, const QDateTime &since, qreal *foodA, qreal *foodB);
+    void addDispense(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB);
+    // Bring the last meal of the cow up to the food known to be given, for a visit resumed after a restart
+    void reconcile(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB);
+
+    // Meals of the last day in the startup snapshot, the ledger stays unseeded until the database reload
+    bool loadSnapshot(const QSqlDatabase &db);
+    bool saveSnapshot(const QSqlDatabase &db);
+
+signals:
+    // Emitted in the thread of the box giving the food
+    void dispensed(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB);
+    // The meals were read again from the database, memory only food is lost
+    void reloaded();
+
+public slots:
+    void reload();
+
+private slots:
+    void newDay();
+
+private:
+    void scheduleNewDay();
+    void prune();
+    void sumSince(int cow, const QDateTime &since, qreal *foodA, qreal *foodB);
+    void add(int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB);
+
+private:
+    struct Meal {
+        QDateTime entry;
+        qreal cumulativeA;                  // Running sums including this meal, so any window is a difference
+        qreal cumulativeB;
+    };
+    struct CowLedger {
+        QVector<Meal> meals;                // Sorted by entry
+        qreal todayA = 0.0;
+        qreal todayB = 0.0;
+        int cursor = 0;                     // First meal of the last window asked, windows only slide forward
+    };
+
+    QMutex m_mutex;
+    QHash<int, CowLedger> m_cows;
+    QTime m_newDayTime = QTime(5, 0);
+    QDateTime m_dayStart;
+    ClockTimer* m_newDayTimer;
+    std::atomic<bool> m_seeded{false};
+    std::atomic<bool> m_snapshotLoaded{false};
+};
+
+#endif // CONSUMPTIONLEDGER_H
@@ -1,90 +1,152 @@
 #include "cowbox.h"
 
 #include <QSqlDatabase>
-#include <QTimer>
+#include <QCoreApplication>
+#include <QThread>
+#include <QDir>
 #include <QtDebug>
 #include <QtSql>
 
 #include "cowdetector.h"
-
-#ifdef Q_OS_WIN
-#include "debuggpio.h"
-#include "debugdetector.h"
-#else
-#include "rpigpio.h"
-#include "innovationreader.h"
-#endif
+#include "identificationcache.h"
+#include "consumptionledger.h"
+#include "databasewriter.h"
+#include "allocationcache.h"
+#include "feedingpolicy.h"
+#include "boxparameterservice.h"
+#include "sqlstatements.h"
+#include "clock.h"
+#include "hardwarefactory.h"
+#include "feedingscheduler.h"
+#include "gpiobatch.h"
+#include "dosingservice.h"
+#include "presencetracker.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "boxstatefile.h"
+
+static const int NoHistoryRetry = 30 * 1000;
 
 CowBox::CowBox(QJsonObject config, QObject *parent) :
     QObject(parent)
   , m_config(config)
-  , m_cowExitTimer(new QTimer(this))
+  , m_cowExitTimer(new ClockTimer(this))
+  , m_scheduler(new FeedingScheduler(this))
+  , m_traceName(Tracer::intern(config.value("name").toString()))
+  , m_detectionLatency(Metrics::histogram("cowdetector_detection_to_dispense_seconds", "From the tag read to the relays on, first dispense of a visit",
+                                          QString("box=\"%1\"").arg(config.value("id").toInt())))
 {
-#ifdef Q_OS_WIN
-    m_foodRelayA = new DebugGpio("gpioFoodA", this);
-    m_foodRelayB = new DebugGpio("gpioFoodB", this);
-    m_foodRelayPhysA = new DebugGpio("gpioFoodPhysA", this);
-    m_foodRelayPhysB = new DebugGpio("gpioFoodPhysB", this);
-    m_calibrationButtonA = new DebugGpio("gpioCalibButtonA", this);
-    m_calibrationButtonB = new DebugGpio("gpioCalibButtonB", this);
-    m_reader = new DebugDetector(this);
-#else
-    m_foodRelayA = new RpiGpio(m_config.value("gpioFoodA").toInt(22), this);
-    m_foodRelayB = new RpiGpio(m_config.value("gpioFoodB").toInt(23), this);
-    m_foodRelayPhysA = new RpiGpio(m_config.value("gpioFoodPhysA").toInt(7), this);
-    m_foodRelayPhysB = new RpiGpio(m_config.value("gpioFoodPhysB").toInt(8), this);
-    m_calibrationButtonA = new RpiGpio(m_config.value("gpioCalibButtonA").toInt(25), GpioInterface::PullUp, 250, this);
-    m_calibrationButtonB = new RpiGpio(m_config.value("gpioCalibButtonB").toInt(24), GpioInterface::PullUp, 250, this);
-    m_reader = new InnovationReader(config.value("detector").toObject(), this);
-#endif
+    // Boxes running in a worker thread get their own connection
+    if (thread() != QCoreApplication::instance()->thread()) {
+        m_connectionName = QString("box-%1").arg(m_config.value("id").toInt());
+        CowDetector::addDatabase(CowDetector::instance()->config(), m_connectionName);
+
+        // Opened once the main connection is up, a server which does not answer would block this thread
+        connect(CowDetector::instance(), &CowDetector::databaseConnected, this, [this]() {
+            m_reconnectTimer.invalidate();
+            reconnectDatabase();
+        });
+        reconnectDatabase();
+    }
+
+    // Real or simulated hardware
+    const QJsonObject &global = CowDetector::instance()->config();
+    m_foodRelayA = HardwareFactory::output(global, "gpioFoodA", m_config.value("gpioFoodA").toInt(22), this);
+    m_foodRelayB = HardwareFactory::output(global, "gpioFoodB", m_config.value("gpioFoodB").toInt(23), this);
+    m_foodRelayPhysA = HardwareFactory::output(global, "gpioFoodPhysA", m_config.value("gpioFoodPhysA").toInt(7), this);
+    m_foodRelayPhysB = HardwareFactory::output(global, "gpioFoodPhysB", m_config.value("gpioFoodPhysB").toInt(8), this);
+    m_calibrationButtonA = HardwareFactory::input(global, "gpioCalibButtonA", m_config.value("gpioCalibButtonA").toInt(25), GpioInterface::PullUp, 250, this);
+    m_calibrationButtonB = HardwareFactory::input(global, "gpioCalibButtonB", m_config.value("gpioCalibButtonB").toInt(24), GpioInterface::PullUp, 250, this);
+    m_reader = HardwareFactory::detector(global, config.value("detector").toObject(), this);
 
     // Revert box signal
-    m_foodRelayA->setOn(false);
-    m_foodRelayB->setOn(false);
-    m_foodRelayPhysA->setOn(false);
-    m_foodRelayPhysB->setOn(false);
-
-    // Load settings from DB box table
-    readBoxParameters();
-    m_readParameterTimer = new QTimer(this);
-    m_readParameterTimer->setInterval(60 * 1000);
-    m_readParameterTimer->setSingleShot(false);
-    connect(m_readParameterTimer, &QTimer::timeout, this, &CowBox::readBoxParameters);
-    m_readParameterTimer->start();
-    qDebug() << "[box initialized] " << name() << m_newDayTime << m_idleStart1 << m_idleStop1 << m_idleStart2 << m_idleStop2 << m_foodSpeedA << m_foodSpeedB;
+    {
+        GpioBatch batch;
+        m_foodRelayA->setOn(false);
+        m_foodRelayB->setOn(false);
+        m_foodRelayPhysA->setOn(false);
+        m_foodRelayPhysB->setOn(false);
+    }
+
+    // Settings from DB box table, applied as soon as they change
+    BoxParameterService* boxParameters = CowDetector::instance()->boxParameters();
+    applyParameters(boxParameters->registerBox(m_config.value("id").toInt(), name()));
+    connect(boxParameters, &BoxParameterService::parametersChanged, this, [this](int box, const BoxParameters &parameters) {
+        if (box == m_config.value("id").toInt()) applyParameters(parameters);
+    });
+    qDebug() << "[box initialized] " << name() << m_parameters.newDayTime << m_parameters.idleStart1 << m_parameters.idleStop1
+             << m_parameters.idleStart2 << m_parameters.idleStop2 << m_parameters.foodSpeedA << m_parameters.foodSpeedB;
+
+    connect(CowDetector::instance()->allocations(), &AllocationCache::allocationChanged, this, [this](int cow, const FoodAllocation &allocation) {
+        if (cow != m_cow) return;
+        m_allocation = allocation;
+        saveState();
+        m_scheduler->schedule(0);
+    });
 
     // Cow detection delay
     m_cowExitTimer->setSingleShot(true);
-    m_cowExitTimer->setInterval(m_detectionDelay * 1000);
-    connect(m_cowExitTimer, &QTimer::timeout, this, &CowBox::cowExit);
+    connect(m_cowExitTimer, &ClockTimer::timeout, this, &CowBox::cowExit);
+    connect(m_scheduler, &FeedingScheduler::due, this, &CowBox::checkFoodDistribution);
 
     // Manual calibration
     connect(m_calibrationButtonA, &GpioInterface::onChanged, this, [this](bool on) {
         if (on && !m_foodRelayA->on() && !m_foodRelayB->on()) {
             qDebug() << "Box " << name() << "calibration for food A";
+            GpioBatch batch;
             m_foodRelayA->setOn(true);
             m_foodRelayPhysA->setOn(true);
-            QTimer::singleShot(m_calibrationTime * 1000, this, SLOT(stopFoodA()));
+            Clock::singleShot(m_parameters.calibrationTime * 1000, this, SLOT(stopFoodA()));
         }
     });
     connect(m_calibrationButtonB, &GpioInterface::onChanged, this, [this](bool on) {
         if (on && !m_foodRelayA->on() && !m_foodRelayB->on()) {
             qDebug() << "Box " << name() << "calibration for food B";
+            GpioBatch batch;
             m_foodRelayB->setOn(true);
             m_foodRelayPhysB->setOn(true);
-            QTimer::singleShot(m_calibrationTime * 1000, this, SLOT(stopFoodB()));
+            Clock::singleShot(m_parameters.calibrationTime * 1000, this, SLOT(stopFoodB()));
         }
     });
 
-    connect(m_reader, &DetectorInterface::idChanged, this, &CowBox::detectedIdChanged);
+    m_presence = new PresenceTracker(m_reader, m_config.value("presence").toObject(), QString("box=\"%1\"").arg(m_config.value("id").toInt()), this);
+    connect(m_presence, &PresenceTracker::presentChanged, this, &CowBox::detectedIdChanged);
+
+    // Live state kept in a mapped file, a restart goes on with the visit in progress
+    QString stateDirectory = global.value("stateDirectory").toString("state");
+    if (!stateDirectory.isEmpty() && QDir().mkpath(stateDirectory)) {
+        m_state = new BoxStateFile(QDir(stateDirectory).filePath(QString("box-%1.state").arg(m_config.value("id").toInt())));
+        restoreState();
+        connect(m_reader, &DetectorInterface::tagRead, this, [this](const QString &id) {
+            if (m_cow <= 0) return;
+            int cow = -1;
+            int card = -1;
+            if (!CowDetector::instance()->identifications()->lookup(id, &cow, &card) || cow != m_cow) return;
+            m_lastSeen = Clock::instance()->now();
+            saveState();
+        });
+    }
 }
 
 CowBox::~CowBox()
 {
-    m_foodRelayA->setOn(false);
-    m_foodRelayB->setOn(false);
-    m_foodRelayPhysA->setOn(false);
-    m_foodRelayPhysB->setOn(false);
+    if (CowDetector::instance()->dosing()) CowDetector::instance()->dosing()->cancel(this);
+    {
+        GpioBatch batch;
+        m_foodRelayA->setOn(false);
+        m_foodRelayB->setOn(false);
+        m_foodRelayPhysA->setOn(false);
+        m_foodRelayPhysB->setOn(false);
+    }
+    CowDetector::instance()->boxParameters()->unregisterBox(m_config.value("id").toInt());
+    delete m_state;
+    m_state = nullptr;
+
+    if (m_connectionName != QSqlDatabase::defaultConnection) {
+        SqlStatements::release(m_connectionName);
+        database().close();
+        QSqlDatabase::removeDatabase(m_connectionName);
+    }
 }
 
 QString CowBox::name() const
@@ -92,12 +154,16 @@ QString CowBox::name() const
     return m_config.value("name").toString();
 }
 
+bool CowBox::isBusy() const
+{
+    return m_cow > 0 || m_foodRelayA->on() || m_foodRelayB->on();
+}
+
 void CowBox::detectedIdChanged(const QString &id)
 {
-    if (!QSqlDatabase::database().isOpen()) {
-        CowDetector::instance()->reconnectDatabase();
-        return;
-    }
+    TRACE_SCOPE("detectedIdChanged", m_traceName);
+    // Feeding goes on from cached data while the database is not reachable
+    if (!database().isOpen()) reconnectDatabase();
 
     // The cow is going out of the box
     if (id.isEmpty()) {
@@ -106,24 +172,10 @@ void CowBox::detectedIdChanged(const QString &id)
         return;
     }
 
-    // Search identification table for corresponding cow
+    // Search identification cache for corresponding cow
     int cow = -1;
     int card = -1;
-    QSqlQuery query(QSqlDatabase::database());
-    query.prepare("SELECT cownumber, cardnumber FROM identification WHERE rfid = :rfid");
-    query.bindValue(":rfid", id);
-    if (!query.exec()) qWarning() << "[CowBox] identification table query error : " << query.lastError().text();
-    else if (query.next()) {
-        cow = query.value(0).toInt();
-        card = query.value(1).toInt();
-    }
-    else {
-        // Create the row with the detected Id, so we could fill it with cow numbers
-        QSqlQuery query(QSqlDatabase::database());
-        query.prepare("INSERT INTO identification (rfid) VALUES (:rfid)");
-        query.bindValue(":rfid",  id);
-        if (!query.exec()) qWarning() << "[CowBox] identification insert query error : " << query.lastError().text();
-    }
+    CowDetector::instance()->identifications()->lookup(id, &cow, &card);
 
     // Check cow number
     if (cow <= 0) {
@@ -139,256 +191,290 @@ void CowBox::detectedIdChanged(const QString &id)
             cowExit();
         }
         m_cow = cow;
-        m_entryTime = QDateTime::currentDateTime();
-        m_foodAllocation_A = 0;
-        m_foodAllocation_B = 0;
-        m_mealCount = -1;
-        m_mealDelay = -1;
-        m_eatSpeed = 6;
-        m_currentMealId = -1;
+        m_entryTime = Clock::instance()->now();
+        m_entryWakeups = m_scheduler->wakeups();
+        m_entryCoalesced = m_scheduler->coalesced();
+        m_entryFlaps = m_presence->statistics().flaps;
+        m_entryRejected = m_presence->statistics().rejected;
+        m_currentMealId = 0;
         m_foodMealA = 0.0;
         m_foodMealB = 0.0;
-        QSqlQuery query(QSqlDatabase::database());
-        query.prepare("SELECT fooda, foodb, mealcount, mealdelay, eatspeed FROM foodallocation WHERE cow = :cow ORDER BY id DESC LIMIT 1");
-        query.bindValue(":cow", m_cow);
-        if (!query.exec()) qWarning() << "[CowBox] foodallocation table query error : " << query.lastError().text();
-        else if (query.next()) {
-            m_foodAllocation_A = query.value(0).toInt();
-            m_foodAllocation_B = query.value(1).toInt();
-            m_mealCount = query.value(2).toInt();
-            m_mealDelay = query.value(3).toInt();
-            m_eatSpeed = query.value(4).toInt();
-            if (m_eatSpeed <= 0) m_eatSpeed = 6;
-        }
+        // Last known allocation at once, a newer one from database is applied when it arrives
+        AllocationCache* allocations = CowDetector::instance()->allocations();
+        allocations->allocation(m_cow, &m_allocation);
+        allocations->refresh(m_cow);
+        m_detected = m_reader->lastRead();
     }
-//    qDebug() << name() << ": Cow entry detected : " << cow << " - " << m_foodAllocation_A << ", " << m_foodAllocation_B;
+//    qDebug() << name() << ": Cow entry detected : " << cow << " - " << m_allocation.foodA << ", " << m_allocation.foodB;
+    m_lastSeen = Clock::instance()->now();
+    saveState();
 
-    checkFoodDistribution();
+    // Tag re-reads in a burst end in one check
+    m_scheduler->schedule(0);
 }
 
 void CowBox::cowExit()
 {
-    if (!QSqlDatabase::database().isOpen()) {
-        CowDetector::instance()->reconnectDatabase();
-        return;
-    }
     if (m_cow <= 0) return;
 
     // Save the empty meal into database to keep track of cow entry/exit between meals
-    if (m_currentMealId < 0) {
-        QSqlQuery query(QSqlDatabase::database());
-        query.prepare("INSERT INTO meals (cow, box, fooda, foodb, entry, exit) VALUES (:cow, :box, :fooda, :foodb, :entry, :exit)");
-        query.bindValue(":cow"  ,  m_cow);
-        query.bindValue(":box"  ,  m_config.value("id").toInt());
-        query.bindValue(":fooda",  m_foodMealA);
-        query.bindValue(":foodb",  m_foodMealB);
-        query.bindValue(":entry",  m_entryTime);
-        query.bindValue(":exit" ,  QDateTime::currentDateTime());
-        if (!query.exec()) qWarning() << "[CowBox] meals insert query error : " << query.lastError().text();
+    if (m_currentMealId == 0) {
+        m_currentMealId = CowDetector::instance()->writer()->newMealId();
+        saveMeal();
     }
 
-    m_currentMealId = -1;
+    m_currentMealId = 0;
     m_cow = -1;
-
+    m_detected = 0;
+    m_scheduler->cancel();
+    saveState();
+    const PresenceStatistics &presence = m_presence->statistics();
+    qDebug() << name() << " Cow exit, food checks : " << m_scheduler->wakeups() - m_entryWakeups << " coalesced : " << m_scheduler->coalesced() - m_entryCoalesced
+             << " flaps : " << presence.flaps - m_entryFlaps << " rejected : " << presence.rejected - m_entryRejected;
 }
 
 void CowBox::checkFoodDistribution()
 {
-    if (!QSqlDatabase::database().isOpen()) {
-        CowDetector::instance()->reconnectDatabase();
-        return;
-    }
+    TRACE_SCOPE("checkFoodDistribution", m_traceName);
     if (m_cow <= 0) return;
     if (!this->isActive()) return;
 
     // We don't resend food if we don't know if the cow is still there or not, we will give again at next connexion
     if (m_cowExitTimer->isActive()) return;
 
-    // Don't send food if some is already given
-    if (m_foodRelayA->on() || m_foodRelayB->on()) return;
-    if ((m_foodAllocation_A < 10) && (m_foodAllocation_B < 10)) {
-        qWarning() << name() <<" [checkFoodDistribution] Cow " << m_cow << " has zero allocation for food : " << m_foodAllocation_A << m_foodAllocation_B;
-        return;
-    }
-    if (qFuzzyIsNull(m_foodSpeedA) || qFuzzyIsNull(m_foodSpeedB )) {
-        qWarning() << name() << " [checkFoodDistribution] Box has zero speed for food : " << m_foodSpeedA << m_foodSpeedB;
+    // Don't send food if some is already given, check again once given
+    if (m_foodRelayA->on() || m_foodRelayB->on()) {
+        m_scheduler->schedule(qMax(qint64(0), Clock::instance()->now().msecsTo(m_dispenseEnd)) + 1000);
         return;
     }
 
-    // Check the 6gr per second limit
-    int mealDuration = m_entryTime.msecsTo(QDateTime::currentDateTime());
-    if (mealDuration > 500 && mealDuration < (m_foodMealA + m_foodMealB) * 1000.0 / m_eatSpeed) {
-        QTimer::singleShot(2000, this, SLOT(checkFoodDistribution()));
+    // Without meals from the database or the snapshot a cow already fed would get her ration again
+    ConsumptionLedger* ledger = CowDetector::instance()->ledger();
+    if (!ledger->hasHistory()) {
+        qWarning() << name() << " [checkFoodDistribution] No meal history yet, no food for cow " << m_cow;
+        m_scheduler->schedule(NoHistoryRetry);
         return;
     }
 
-    // Check already allocated meal for the day
-    QSqlQuery query(QSqlDatabase::database());
-    query.prepare("SELECT SUM(fooda), SUM(foodb) FROM meals WHERE cow = :cow AND entry > :starttime");
-    query.bindValue(":cow", m_cow);
-    QDate startDate = QDate::currentDate();
-    if (QTime::currentTime() < m_newDayTime) startDate = startDate.addDays(-1);     // When the new day time is not yet passed, we have to check against previous day.
-    query.bindValue(":starttime", QDateTime(startDate, m_newDayTime));
-    if (!query.exec() || !query.next()) {
-        qWarning() << "[CowBox] meals day query error : " << query.lastError().text();
+    // Food already allocated for the day and the meal interval
+    QDateTime now = Clock::instance()->now();
+    FeedingState state;
+    state.allocation = m_allocation;
+    state.entry = m_entryTime;
+    state.mealA = m_foodMealA;
+    state.mealB = m_foodMealB;
+    ledger->eatenToday(m_cow, ConsumptionLedger::dayStart(m_parameters.newDayTime, now), &state.eatenTodayA, &state.eatenTodayB);
+    ledger->eatenSince(m_cow, now.addSecs(-FeedingPolicy::mealInterval(m_allocation)), &state.eatenIntervalA, &state.eatenIntervalB);
+
+    FeedingDecision decision = FeedingPolicy::decide(state, m_parameters, now);
+    switch (decision.action) {
+    case FeedingDecision::ZeroAllocation:
+        qWarning() << name() <<" [checkFoodDistribution] Cow " << m_cow << " has zero allocation for food : " << m_allocation.foodA << m_allocation.foodB;
         return;
-    }
-    qreal eatenTodayA = query.value(0).toReal();
-    qreal eatenTodayB = query.value(1).toReal();
-
-    // Check already allocated meal for the mealInterval
-    if (m_mealCount <= 0) {
-        m_mealCount = 2;
-        if (m_foodAllocation_A + m_foodAllocation_B > 3000) m_mealCount = 4;
-        if (m_foodAllocation_A + m_foodAllocation_B > 6000) m_mealCount = 6;
-    }
-    int mealInterval = m_mealDelay * 60;
-    if (mealInterval <= 0) mealInterval = qRound(18.0 * 3600.0 / m_mealCount);     // spread on 18 hours
-    query.prepare("SELECT SUM(fooda), SUM(foodb) FROM meals WHERE cow = :cow AND entry > :starttime");
-    query.bindValue(":cow", m_cow);
-    query.bindValue(":starttime", QDateTime::currentDateTime().addSecs(-mealInterval));
-    if (!query.exec() || !query.next()) {
-        qWarning() << "[CowBox] meals day query error : " << query.lastError().text();
+    case FeedingDecision::ZeroSpeed:
+        qWarning() << name() << " [checkFoodDistribution] Box has zero speed for food : " << m_parameters.foodSpeedA << m_parameters.foodSpeedB;
         return;
-    }
-    qreal eatenMealA = query.value(0).toReal();
-    qreal eatenMealB = query.value(1).toReal();
-
-    // Compute food to give, in case food alloc < minimum give all remaining food
-    qreal giveFoodA = qMax(0.0, m_foodAllocation_A - eatenTodayA);
-    qreal giveFoodB = qMax(0.0, m_foodAllocation_B - eatenTodayB);
-    if (giveFoodA > 2 * m_mealMinimum) giveFoodA = qMin(giveFoodA, (qreal)m_foodAllocation_A / m_mealCount - eatenMealA);
-    if (giveFoodB > 2 * m_mealMinimum) giveFoodB = qMin(giveFoodB, (qreal)m_foodAllocation_B / m_mealCount - eatenMealB);
-    if (giveFoodA > 2 * m_mealMinimum) giveFoodA = qMin(giveFoodA, (qreal)m_foodAllocation_A / (m_foodAllocation_A + m_foodAllocation_B) * m_mealMinimum);
-    if (giveFoodB > 2 * m_mealMinimum) giveFoodB = qMin(giveFoodB, (qreal)m_foodAllocation_B / (m_foodAllocation_A + m_foodAllocation_B) * m_mealMinimum);
-    giveFoodA = qRound(qMax(0.0, giveFoodA));
-    giveFoodB = qRound(qMax(0.0, giveFoodB));
-    if (giveFoodA + giveFoodB < 50) {
-        // In the case the cow is still there without moving in 5 minutes
-        QTimer::singleShot(5 * 60 * 1000, this, SLOT(checkFoodDistribution()));
+    case FeedingDecision::Wait:
+        m_scheduler->schedule(decision.nextCheck);
         return;
+    case FeedingDecision::Dispense:
+        break;
     }
 
-    // Give the food
-    m_foodMealA += giveFoodA;
-    m_foodMealB += giveFoodB;
-    int foodAonTime = giveFoodA / m_foodSpeedA * 1000;
-    int foodBonTime = giveFoodB / m_foodSpeedB * 1000;
-    if (foodAonTime > 1000) {
-        // Don't distribute for less than 1 seconds to avoid problem on the relay
-        m_foodRelayA->setOn(true);
-        m_foodRelayPhysA->setOn(true);
-        QTimer::singleShot(foodAonTime, this, SLOT(stopFoodA()));
+    // Give the food, the meal is booked as planned and corrected with the measured on-times
+    m_dispenseEnd = now.addMSecs(qMax(decision.onTimeA, decision.onTimeB));
+    m_foodMealA += decision.foodA;
+    m_foodMealB += decision.foodB;
+    ledger->addDispense(m_cow, m_entryTime, decision.foodA, decision.foodB);
+    if (m_currentMealId == 0) m_currentMealId = CowDetector::instance()->writer()->newMealId();
+    {
+        GpioBatch batch;            // Both foods and their physical relays switch together
+        if (decision.onTimeA > 0) {
+            m_foodRelayA->setOn(true);
+            m_foodRelayPhysA->setOn(true);
+        }
+        if (decision.onTimeB > 0) {
+            m_foodRelayB->setOn(true);
+            m_foodRelayPhysB->setOn(true);
+        }
     }
-    if (foodBonTime > 1000) {
-        m_foodRelayB->setOn(true);
-        m_foodRelayPhysB->setOn(true);
-        QTimer::singleShot(foodBonTime, this, SLOT(stopFoodB()));
+    Tracer::instant("relays on", m_traceName);
+    if (m_detected > 0) {
+        m_detectionLatency->observe(Metrics::now() - m_detected);
+        m_detected = 0;
     }
-    qDebug() << name() << " : Start food distribution to cow " << m_cow << " : today, meal, given: " << eatenTodayA << eatenTodayB << " -- " << eatenMealA << eatenMealB << " -- " << giveFoodA << giveFoodB;
+    if (decision.onTimeA > 0) startFood(m_foodRelayA, m_foodRelayPhysA, decision.onTimeA, decision.foodA, SLOT(stopFoodA()));
+    if (decision.onTimeB > 0) startFood(m_foodRelayB, m_foodRelayPhysB, decision.onTimeB, decision.foodB, SLOT(stopFoodB()));
+    qDebug() << name() << " : Start food distribution to cow " << m_cow << " : today, meal, given: " << state.eatenTodayA << state.eatenTodayB
+             << " -- " << state.eatenIntervalA << state.eatenIntervalB << " -- " << decision.foodA << decision.foodB;
 
     // Schedule next check for food
-    QTimer::singleShot(1000 + qMax(giveFoodA / m_foodSpeedA * 1000, giveFoodB / m_foodSpeedB * 1000), this, SLOT(checkFoodDistribution()));
-
-    // Save the meal into database
-    if (m_currentMealId < 0) {
-        QSqlQuery query(QSqlDatabase::database());
-        query.prepare("INSERT INTO meals (cow, box, fooda, foodb, entry, exit) VALUES (:cow, :box, :fooda, :foodb, :entry, :exit) RETURNING id");
-        query.bindValue(":cow"  ,  m_cow);
-        query.bindValue(":box"  ,  m_config.value("id").toInt());
-        query.bindValue(":fooda",  m_foodMealA);
-        query.bindValue(":foodb",  m_foodMealB);
-        query.bindValue(":entry",  m_entryTime);
-        query.bindValue(":exit" ,  QDateTime::currentDateTime());
-        if (!query.exec()) qWarning() << "[CowBox] meals insert query error : " << query.lastError().text();
-
-        // Get id of the row just inserted
-        if (query.next()) m_currentMealId = query.value(0).toInt();
+    m_scheduler->schedule(decision.nextCheck);
+
+    // Save the meal into database, written behind by the database writer thread
+    saveMeal();
+    saveState();
+}
+
+void CowBox::startFood(GpioInterface *relay, GpioInterface *physicalRelay, int onTime, qreal food, const char *stopMember)
+{
+    QList<GpioInterface*> relays = { relay, physicalRelay };
+    DosingService* dosing = CowDetector::instance()->dosing();
+    if (!dosing || !dosing->accepts(relays)) {
+        Clock::singleShot(onTime, this, stopMember);
+        return;
+    }
+
+    // Relays are already off when done is called, relaysOff only updates their state.
+    // The off instant is traced by the dosing thread when they really switch.
+    bool foodA = relay == m_foodRelayA;
+    qreal speed = foodA ? m_parameters.foodSpeedA : m_parameters.foodSpeedB;
+    qint64 mealId = m_currentMealId;
+    int cow = m_cow;
+    QDateTime entry = m_entryTime;
+    m_pendingMeals[mealId].doses++;
+    dosing->dose(relays, DosingService::monotonicNs(), onTime, this, [=](qint64 onTimeNs) {
+        relaysOff(relay, physicalRelay);
+        qreal given = onTimeNs / 1e9 * speed;
+        qDebug() << name() << " : Food " << (foodA ? "A" : "B") << " on for " << onTimeNs / 1000000 << "ms, planned " << onTime << "ms";
+        if (foodA) correctMeal(mealId, cow, entry, given - food, 0.0);
+        else correctMeal(mealId, cow, entry, 0.0, given - food);
+        auto i = m_pendingMeals.find(mealId);
+        if (i != m_pendingMeals.end() && --i->doses <= 0) m_pendingMeals.erase(i);
+    }, foodA ? "relay A off" : "relay B off", m_traceName);
+}
+
+void CowBox::correctMeal(qint64 mealId, int cow, const QDateTime &entry, qreal foodA, qreal foodB)
+{
+    CowDetector::instance()->ledger()->addDispense(cow, entry, foodA, foodB);
+
+    if (mealId == m_currentMealId) {
+        m_foodMealA += foodA;
+        m_foodMealB += foodB;
+        saveMeal();
+        saveState();
     }
-    else {
-        // Update current meal
-        QSqlQuery query(QSqlDatabase::database());
-        query.prepare("UPDATE meals SET fooda = :fooda, foodb = :foodb, exit = :exit WHERE id = :id");
-        query.bindValue(":fooda",  m_foodMealA);
-        query.bindValue(":foodb",  m_foodMealB);
-        query.bindValue(":exit" ,  QDateTime::currentDateTime());
-        query.bindValue(":id",  m_currentMealId);
-        if (!query.exec()) qWarning() << "[CowBox] meal update query error : " << query.lastError().text();
+    else if (m_pendingMeals.contains(mealId)) {
+        // The cow is gone, its meal row was saved with the planned food
+        MealRecord &meal = m_pendingMeals[mealId].meal;
+        meal.foodA += foodA;
+        meal.foodB += foodB;
+        CowDetector::instance()->writer()->saveMeal(meal);
     }
 }
 
 void CowBox::stopFoodA()
 {
-    m_foodRelayA->setOn(false);
-    m_foodRelayPhysA->setOn(false);
+    Tracer::instant("relay A off", m_traceName);
+    relaysOff(m_foodRelayA, m_foodRelayPhysA);
 }
 
 void CowBox::stopFoodB()
 {
-    m_foodRelayB->setOn(false);
-    m_foodRelayPhysB->setOn(false);
+    Tracer::instant("relay B off", m_traceName);
+    relaysOff(m_foodRelayB, m_foodRelayPhysB);
+}
+
+void CowBox::relaysOff(GpioInterface *relay, GpioInterface *physicalRelay)
+{
+    GpioBatch batch;
+    relay->setOn(false);
+    physicalRelay->setOn(false);
 }
 
 bool CowBox::isActive() const
 {
-    if (!m_idleStart1.isNull() && !m_idleStop1.isNull()) {
-        QTime current = QTime::currentTime();
-        if (current > m_idleStart1 && current < m_idleStop1) return false;
-    }
+    return FeedingPolicy::isActive(m_parameters, Clock::instance()->now().time());
+}
 
-    if (!m_idleStart2.isNull() && !m_idleStop2.isNull()) {
-        QTime current = QTime::currentTime();
-        if (current > m_idleStart2 && current < m_idleStop2) return false;
-    }
+void CowBox::applyParameters(const BoxParameters &parameters)
+{
+    m_parameters = parameters;
+    m_cowExitTimer->setInterval(m_parameters.detectionDelay * 1000);
+}
 
-    return true;
+QSqlDatabase CowBox::database() const
+{
+    return QSqlDatabase::database(m_connectionName, false);
 }
 
-void CowBox::readBoxParameters()
+void CowBox::reconnectDatabase()
 {
-    if (!QSqlDatabase::database().isOpen()) {
+    if (m_connectionName == QSqlDatabase::defaultConnection) {
         CowDetector::instance()->reconnectDatabase();
         return;
     }
 
-    QSqlQuery query(QSqlDatabase::database());
-    query.prepare("SELECT newdaytime, idlestart1, idlestop1, idlestart2, idlestop2, foodspeeda, foodspeedb, calibrationtime, mealminimum, detectiondelay FROM box WHERE boxnumber = :boxnumber");
-    query.bindValue(":boxnumber", m_config.value("id").toInt());
-    if (!query.exec()) qWarning() << "[CowBox] box table query error : " << query.lastError().text();
-    else {
-        if (query.next()) {
-            m_newDayTime = query.value(0).toTime();
-            m_idleStart1 = query.value(1).toTime();
-            m_idleStop1  = query.value(2).toTime();
-            m_idleStart2 = query.value(3).toTime();
-            m_idleStop2  = query.value(4).toTime();
-            m_foodSpeedA = query.value(5).toReal();
-            m_foodSpeedB = query.value(6).toReal();
-            m_calibrationTime = query.value(7).toInt();
-            m_mealMinimum = query.value(8).toInt();
-            m_detectionDelay = query.value(9).toInt();
-        }
-        else {
-            // Create the row with default values
-            m_newDayTime = QTime(5, 0);     // 5 AM
-            m_foodSpeedA = 7;
-            m_foodSpeedB = 7;
-            QSqlQuery query(QSqlDatabase::database());
-            query.prepare("INSERT INTO box (boxnumber, boxname, newdaytime, foodspeeda, foodspeedb) "
-                          "VALUES (:boxNumber, :boxName, :newDayTime, :foodSpeedA, :foodSpeedB)");
-            query.bindValue(":boxNumber",   m_config.value("id").toInt());
-            query.bindValue(":boxName",     m_config.value("name").toString());
-            query.bindValue(":newDayTime",  m_newDayTime);
-            query.bindValue(":foodSpeedA",  m_foodSpeedA);
-            query.bindValue(":foodSpeedB",  m_foodSpeedB);
-            if (!query.exec()) qWarning() << "[CowBox] box insert query error : " << query.lastError().text();
-        }
+    if (!CowDetector::instance()->isDatabaseConnected()) return;
+    if (m_reconnectTimer.isValid() && m_reconnectTimer.elapsed() < 20000) return;
+    m_reconnectTimer.start();
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"box\"");
+    reconnects->add();
+    QSqlDatabase db = database();
+    if (!db.open()) qWarning() << name() << " Database connection error : " << db.lastError().text();
+    else SqlStatements::opened(db);
+}
+
+void CowBox::saveState()
+{
+    if (!m_state) return;
+    BoxState state;
+    state.cow = m_cow;
+    if (m_cow > 0) {
+        state.mealId = m_currentMealId;
+        state.entry = m_entryTime.toMSecsSinceEpoch();
+        state.lastSeen = m_lastSeen.toMSecsSinceEpoch();
+        state.foodMealA = m_foodMealA;
+        state.foodMealB = m_foodMealB;
+        state.allocation = m_allocation;
+    }
+    m_state->write(state);
+}
+
+void CowBox::restoreState()
+{
+    BoxState state;
+    if (!m_state->read(&state) || state.cow <= 0) return;
+
+    // Same rule as the exit timer, a cow not seen for the detection delay has left
+    qint64 unseen = QDateTime::fromMSecsSinceEpoch(state.lastSeen).msecsTo(Clock::instance()->now());
+    if (unseen < 0 || unseen > m_parameters.detectionDelay * 1000) {
+        qDebug() << name() << " Cow " << state.cow << " not resumed, not seen for " << unseen / 1000 << "s";
+        saveState();
+        return;
     }
 
-    // Fill last connected column
-    query.prepare("UPDATE box SET lastconnected = :lastconnected WHERE boxnumber = :boxnumber");
-    query.bindValue(":boxnumber",   m_config.value("id").toInt());
-    query.bindValue(":lastconnected", QDateTime::currentDateTime());
-    if (!query.exec()) qWarning() << "[CowBox] box update last connected error : " << query.lastError().text();
+    // Relays were reset, food is given again once the reader sees the cow, in the same meal row
+    m_cow = state.cow;
+    m_entryTime = QDateTime::fromMSecsSinceEpoch(state.entry);
+    m_lastSeen = QDateTime::fromMSecsSinceEpoch(state.lastSeen);
+    m_currentMealId = state.mealId;
+    m_foodMealA = state.foodMealA;
+    m_foodMealB = state.foodMealB;
+    m_allocation = state.allocation;
+    m_cowExitTimer->start();
+    qDebug() << name() << " Resume cow " << m_cow << " entered " << m_entryTime << " meal " << m_currentMealId << " : " << m_foodMealA << m_foodMealB;
+
+    // The ledger comes from a snapshot or a database which may miss the last doses, the state file knows them.
+    // Done again once the database reload replaced the ledger.
+    CowDetector::instance()->ledger()->reconcile(m_cow, m_entryTime, m_foodMealA, m_foodMealB);
+    QDateTime entry = m_entryTime;
+    connect(CowDetector::instance()->ledger(), &ConsumptionLedger::reloaded, this, [this, entry]() {
+        if (m_cow > 0 && m_entryTime == entry) CowDetector::instance()->ledger()->reconcile(m_cow, m_entryTime, m_foodMealA, m_foodMealB);
+    });
+}
 
+void CowBox::saveMeal()
+{
+    MealRecord meal;
+    meal.id = m_currentMealId;
+    meal.cow = m_cow;
+    meal.box = m_config.value("id").toInt();
+    meal.foodA = m_foodMealA;
+    meal.foodB = m_foodMealB;
+    meal.entry = m_entryTime;
+    meal.exit = Clock::instance()->now();
+    auto i = m_pendingMeals.find(meal.id);
+    if (i != m_pendingMeals.end()) i->meal = meal;
+    CowDetector::instance()->writer()->saveMeal(meal);
 }
@@ -3,11 +3,22 @@
 
 #include <QJsonObject>
 #include <QObject>
+#include <QHash>
 #include <QDateTime>
-#include <QTimer>
+#include <QElapsedTimer>
+#include <QSqlDatabase>
 
 #include "gpiointerface.h"
 #include "detectorinterface.h"
+#include "boxparameters.h"
+#include "allocationcache.h"
+#include "localjournal.h"
+
+class ClockTimer;
+class FeedingScheduler;
+class PresenceTracker;
+class MetricHistogram;
+class BoxStateFile;
 
 class CowBox : public QObject
 {
@@ -28,8 +39,11 @@ public:
     GpioInterface* calibrationButtonA() const { return m_calibrationButtonA; }
     GpioInterface* calibrationButtonB() const { return m_calibrationButtonB; }
     DetectorInterface* rfid() const { return m_reader; }
+    PresenceTracker* presence() const { return m_presence; }
 
     QString name() const;
+    // A cow is in the box or food is given, the box must not be rebuilt now
+    bool isBusy() const;
 
 private slots:
     void detectedIdChanged(const QString &id);
@@ -40,7 +54,15 @@ private slots:
 
 private:
     bool isActive() const;
-    void readBoxParameters();
+    void applyParameters(const BoxParameters &parameters);
+    void saveMeal();
+    void startFood(GpioInterface *relay, GpioInterface *physicalRelay, int onTime, qreal food, const char *stopMember);
+    void relaysOff(GpioInterface *relay, GpioInterface *physicalRelay);
+    void correctMeal(qint64 mealId, int cow, const QDateTime &entry, qreal foodA, qreal foodB);
+    QSqlDatabase database() const;
+    void reconnectDatabase();
+    void saveState();
+    void restoreState();
 
 private:
     QJsonObject m_config;
@@ -52,34 +74,39 @@ private:
     GpioInterface* m_calibrationButtonA;
     GpioInterface* m_calibrationButtonB;
     DetectorInterface* m_reader;
-    QTimer* m_cowExitTimer;
-    QTimer* m_readParameterTimer;
+    PresenceTracker* m_presence;            // Clean entries and exits from the reader
+    ClockTimer* m_cowExitTimer;
+    FeedingScheduler* m_scheduler;          // Single pending food check
+    const char* m_traceName;                // Box name kept by the tracer
+    MetricHistogram* m_detectionLatency;
+    QString m_connectionName = QSqlDatabase::defaultConnection;
+    QElapsedTimer m_reconnectTimer;
+    BoxStateFile* m_state = nullptr;        // Null when "stateDirectory" is empty
 
-    // From box table, updated only at boot
-    QTime m_newDayTime;
-    QTime m_idleStart1;
-    QTime m_idleStop1;
-    QTime m_idleStart2;
-    QTime m_idleStop2;
-    qreal m_foodSpeedA = 0.0;
-    qreal m_foodSpeedB = 0.0;
-    int m_calibrationTime = 120;            // 120s for box food calibration
-    int m_mealMinimum = 100;                // 100gr food distribution at each detection
-    int m_detectionDelay = 30;              // 30s between connections of the cow
+    // From box table, pushed by the parameter service
+    BoxParameters m_parameters;
 
     // From foodallocation table once a cow is in the box
     int m_cow = -1;
-    int m_foodAllocation_A = 0;
-    int m_foodAllocation_B = 0;
-    int m_mealCount = -1;
-    int m_mealDelay = -1;
-    int m_eatSpeed = 6;
+    FoodAllocation m_allocation;
     QDateTime m_entryTime;
+    QDateTime m_lastSeen;                   // Last tag read of the cow, to know after a restart if she may still be there
+    qint64 m_detected = 0;                  // Tag read time of the entry (Metrics::now), until the first dispense
+    quint64 m_entryWakeups = 0;             // Counters at the entry, the exit log gives the visit share
+    quint64 m_entryCoalesced = 0;
+    quint64 m_entryFlaps = 0;
+    quint64 m_entryRejected = 0;
 
     // Current meal distribution
-    int m_currentMealId = -1;
+    qint64 m_currentMealId = 0;             // Reserved by the database writer, 0 when no food given yet
     qreal m_foodMealA = 0.0;
     qreal m_foodMealB = 0.0;
+    QDateTime m_dispenseEnd;                // Relays are off after
+    struct PendingMeal {
+        MealRecord meal;                    // Last saved, corrected when a dose ends after the cow exit
+        int doses = 0;
+    };
+    QHash<qint64, PendingMeal> m_pendingMeals;  // Meals with a dose not done yet, by id
 };
 
 #endif // COWBOX_H
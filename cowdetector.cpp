@@ -3,43 +3,135 @@
 #include <QtSql>
 #include <QtDebug>
 #include <QTimer>
+#include <QTcpSocket>
 
 #include "gpiointerface.h"
-
-#ifdef Q_OS_WIN
-#include "debuggpio.h"
-#else
-#include "rpigpio.h"
+#include "identificationcache.h"
+#include "consumptionledger.h"
+#include "databasewriter.h"
+#include "allocationcache.h"
+#include "boxparameterservice.h"
+#include "sqlstatements.h"
+#include "clock.h"
+#include "hardwarefactory.h"
+#include "dosingservice.h"
+#include "metrics.h"
+#include "startupsnapshot.h"
+#include "startupphases.h"
+#ifdef Q_OS_LINUX
+#include "rfidioservice.h"
 #endif
 
+
+/*
+ * Boxes are created before the database is reached : they feed from the startup snapshot
+ * and the server is first probed with a non blocking TCP connection, opening a Postgres
+ * connection to a host which does not answer blocks the main thread for the connect timeout.
+ */
+
+static const int ProbeTimeout = 3000;
+
 CowDetector* CowDetector::m_instance = nullptr;
 
 CowDetector::CowDetector(const QJsonObject &config, QObject *parent) :
     QObject(parent)
   , m_config(config)
-  , m_runningTimer(new QTimer(this))
+  , m_runningTimer(new ClockTimer(this))
+  , m_identifications(new IdentificationCache(this))
+  , m_ledger(new ConsumptionLedger(this))
+  , m_allocations(new AllocationCache(config))
+  , m_boxParameters(new BoxParameterService(this))
 {
+    m_boxParameters->setReadOnly(m_config.value("readOnly").toBool(false));
+
+    // One day change for the shared ledger, boxes with another new day time sum their own window
+    QTime newDayTime = QTime::fromString(m_config.value("newDayTime").toString("05:00"), "HH:mm");
+    if (newDayTime.isValid()) m_ledger->setNewDayTime(newDayTime);
+    else qWarning() << "[CowDetector] Invalid newDayTime, expected HH:mm : " << m_config.value("newDayTime").toString();
+
     // Launch a timer to blink a led showing application is running
-#ifdef Q_OS_WIN
-    m_runningGpio = new DebugGpio("Running", this);
-#else
-    m_runningGpio = new RpiGpio(m_config.value("runningGpio").toInt(27), nullptr);
-#endif
+    m_runningGpio = HardwareFactory::output(m_config, "Running", m_config.value("runningGpio").toInt(27), nullptr);
     m_runningTimer->setSingleShot(false);
     m_runningTimer->setInterval(3000);
-    QObject::connect(m_runningTimer, &QTimer::timeout, m_runningGpio, [this]() { m_runningGpio->pulse(1500); });
-
-    QSqlDatabase db = QSqlDatabase::addDatabase("QPSQL");
-    db.setHostName      (m_config.value("databaseHost").toString());
-    db.setPort          (m_config.value("databasePort").toInt());
-    db.setDatabaseName  (m_config.value("databaseName").toString());
-    db.setUserName      (m_config.value("databaseUser").toString());
-    db.setPassword      (m_config.value("databasePwd").toString());
+    QObject::connect(m_runningTimer, &ClockTimer::timeout, m_runningGpio, [this]() { m_runningGpio->pulse(1500); });
+
+    // Queries timings, to see which one dominates
+    int reportInterval = m_config.value("statementReportInterval").toInt(60);
+    if (reportInterval > 0) {
+        QTimer* reportTimer = new QTimer(this);
+        reportTimer->setInterval(reportInterval * 60 * 1000);
+        connect(reportTimer, &QTimer::timeout, this, []() { SqlStatements::report(); });
+        reportTimer->start();
+    }
+
+    // Prometheus text on a local port
+    int metricsPort = m_config.value("metricsPort").toInt(0);
+    if (metricsPort > 0) new MetricsServer(m_config.value("metricsAddress").toString("127.0.0.1"), metricsPort, this);
+
+    addDatabase(m_config);
+
+    // Last known caches, replaced by the database once it answers
+    QString snapshotFile = m_config.value("snapshotFile").toString("cowdetector-snapshot.db");
+    if (!snapshotFile.isEmpty()) {
+        m_snapshot = new StartupSnapshot(snapshotFile);
+        m_snapshot->load(m_identifications, m_allocations, m_boxParameters, m_ledger);
+        StartupPhases::mark("snapshot");
+
+        int snapshotInterval = m_config.value("snapshotInterval").toInt(10);
+        if (snapshotInterval > 0) {
+            QTimer* snapshotTimer = new QTimer(this);
+            snapshotTimer->setInterval(snapshotInterval * 60 * 1000);
+            connect(snapshotTimer, &QTimer::timeout, this, &CowDetector::saveSnapshot);
+            snapshotTimer->start();
+        }
+    }
+    // Meals are written by their own thread and connection, the ledger is seeded once the meals given offline are replayed
+    m_writer = new DatabaseWriter(m_config);
+    connect(m_writer, &DatabaseWriter::identificationsDropped, m_identifications, &IdentificationCache::forgetInserted);
+    connect(m_writer, &DatabaseWriter::backlogReplayed, this, &CowDetector::seedLedger);
+    m_writer->start();
+
+    // Allocations are read by their own thread and connection, started before the first reload
+    m_allocations->start();
     reconnectDatabase();
+
+    // Relays switched off at their deadline by a dedicated thread, simulated relays follow the simulated clock
+    if (!HardwareFactory::isSimulated(m_config) && m_config.value("dosingService").toBool(true)) {
+        m_dosing = new DosingService;
+        if (!m_dosing->isAvailable()) {
+            delete m_dosing;
+            m_dosing = nullptr;
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    // All reader ports multiplexed on one thread, for hosts with many boxes
+    if (!HardwareFactory::isSimulated(m_config) && m_config.value("rfidIoService").toBool(false)) {
+        m_rfidService = new RfidIoService(m_config.value("rfidRepeatInterval").toInt(1000));
+        if (!m_rfidService->isValid()) {
+            delete m_rfidService;
+            m_rfidService = nullptr;
+        }
+    }
+#endif
 }
 
 CowDetector::~CowDetector()
 {
+    saveSnapshot();
+    delete m_snapshot;
+    m_snapshot = nullptr;
+    if (m_dosing) qDebug() << "[CowDetector] Dosing maximum lateness : " << m_dosing->maximumLateness() / 1000 << "us";
+    delete m_dosing;
+    m_dosing = nullptr;
+#ifdef Q_OS_LINUX
+    delete m_rfidService;
+    m_rfidService = nullptr;
+#endif
+    delete m_writer;
+    m_writer = nullptr;
+    delete m_allocations;
+    m_allocations = nullptr;
     delete m_runningGpio;
     m_runningGpio = nullptr;
 }
@@ -62,15 +154,105 @@ void CowDetector::deleteCowDetector()
     m_instance = nullptr;
 }
 
+QSqlDatabase CowDetector::addDatabase(const QJsonObject &config, const QString &connectionName)
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QPSQL", connectionName);
+    db.setHostName      (config.value("databaseHost").toString());
+    db.setPort          (config.value("databasePort").toInt());
+    db.setDatabaseName  (config.value("databaseName").toString());
+    db.setUserName      (config.value("databaseUser").toString());
+    db.setPassword      (config.value("databasePwd").toString());
+    db.setConnectOptions("connect_timeout=3");         // Boxes keep feeding offline, don't wait long for an unreachable server
+    return db;
+}
+
 void CowDetector::reconnectDatabase()
 {
+    if (m_probe) return;
     if (m_timer.isValid() && m_timer.elapsed() < 20000) return;
     m_timer.start();
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"database\"");
+    reconnects->add();
 
-    if (!QSqlDatabase::database().open()) {
-        qWarning() << "Database connection error : " << QSqlDatabase::database().lastError().text();
-        QTimer::singleShot(30 * 1000, this, SLOT(reconnectDatabase()));
-        m_runningTimer->stop();
+    // Local socket connections fail at once, "deferredDatabase": false opens synchronously like tools expect
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!m_config.value("deferredDatabase").toBool(true) || db.hostName().isEmpty() || db.hostName().startsWith('/')) {
+        openDatabase();
+        return;
     }
-    else m_runningTimer->start();
+
+    QTcpSocket* probe = new QTcpSocket(this);
+    m_probe = probe;
+    connect(probe, &QTcpSocket::connected, this, [this]() {
+        endProbe();
+        openDatabase();
+    });
+    auto probeError = [this, probe]() {
+        qWarning() << "Database connection error : " << probe->errorString();
+        endProbe();
+        databaseFailed();
+    };
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(probe, &QAbstractSocket::errorOccurred, this, probeError);
+#else
+    connect(probe, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error), this, probeError);
+#endif
+    QTimer::singleShot(ProbeTimeout, probe, [this, probe]() {
+        if (m_probe != probe) return;
+        qWarning() << "Database connection error : no answer from " << probe->peerName();
+        endProbe();
+        databaseFailed();
+    });
+    probe->connectToHost(db.hostName(), quint16(db.port() > 0 ? db.port() : 5432));
+}
+
+void CowDetector::saveSnapshot()
+{
+    if (m_snapshot) m_snapshot->save(m_identifications, m_allocations, m_boxParameters, m_ledger);
+}
+
+void CowDetector::openDatabase()
+{
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!db.open()) {
+        qWarning() << "Database connection error : " << db.lastError().text();
+        databaseFailed();
+        return;
+    }
+    SqlStatements::opened(db);
+
+    m_databaseConnected = true;
+    m_runningTimer->start();
+    m_identifications->reload();
+    // Tools opening synchronously expect the allocations once connected
+    bool deferred = m_config.value("deferredDatabase").toBool(true);
+    QMetaObject::invokeMethod(m_allocations, "reload", deferred ? Qt::QueuedConnection : Qt::BlockingQueuedConnection);
+    m_boxParameters->reload();
+    seedLedger();
+    StartupPhases::mark("database");
+    saveSnapshot();
+    emit databaseConnected();
+}
+
+void CowDetector::seedLedger()
+{
+    // Reseeding before the journal replay would drop the meals given offline, they would be given again
+    if (!m_databaseConnected || m_ledger->isSeeded() || m_writer->hasBacklog()) return;
+    m_ledger->reload();
+}
+
+void CowDetector::databaseFailed()
+{
+    m_databaseConnected = false;
+    Clock::singleShot(30 * 1000, this, SLOT(reconnectDatabase()));
+    m_runningTimer->stop();
+}
+
+void CowDetector::endProbe()
+{
+    // Signals first, abort would report the socket again
+    m_probe->disconnect(this);
+    m_probe->abort();
+    m_probe->deleteLater();
+    m_probe = nullptr;
 }
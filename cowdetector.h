@@ -4,9 +4,20 @@
 #include <QObject>
 #include <QJsonObject>
 #include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <atomic>
 
-class QTimer;
+class ClockTimer;
 class GpioInterface;
+class IdentificationCache;
+class ConsumptionLedger;
+class DatabaseWriter;
+class AllocationCache;
+class BoxParameterService;
+class DosingService;
+class RfidIoService;
+class StartupSnapshot;
+class QTcpSocket;
 
 class CowDetector : public QObject
 {
@@ -18,19 +29,49 @@ public:
     static CowDetector* firstInstance(const QJsonObject &config);
     static CowDetector* instance();
     static void deleteCowDetector();
+    static QSqlDatabase addDatabase(const QJsonObject &config, const QString &connectionName = QLatin1String(QSqlDatabase::defaultConnection));
 
+    const QJsonObject& config() const { return m_config; }
     GpioInterface* runningGpio() { return m_runningGpio; }
+    IdentificationCache* identifications() { return m_identifications; }
+    ConsumptionLedger* ledger() { return m_ledger; }
+    DatabaseWriter* writer() { return m_writer; }
+    AllocationCache* allocations() { return m_allocations; }
+    BoxParameterService* boxParameters() { return m_boxParameters; }
+    DosingService* dosing() { return m_dosing; }
+    RfidIoService* rfidService() { return m_rfidService; }
+
+    // Thread safe, false until the default connection is opened and after a failed attempt
+    bool isDatabaseConnected() const { return m_databaseConnected.load(); }
 
 signals:
+    void databaseConnected();
 
 public slots:
     void reconnectDatabase();
+    void saveSnapshot();
+
+private:
+    void openDatabase();
+    void databaseFailed();
+    void seedLedger();
+    void endProbe();
 
 private:
     static CowDetector* m_instance;
     QJsonObject m_config;
     GpioInterface* m_runningGpio = nullptr;
-    QTimer *m_runningTimer = nullptr;
+    ClockTimer *m_runningTimer = nullptr;
+    IdentificationCache* m_identifications = nullptr;
+    ConsumptionLedger* m_ledger = nullptr;
+    DatabaseWriter* m_writer = nullptr;
+    AllocationCache* m_allocations = nullptr;
+    BoxParameterService* m_boxParameters = nullptr;
+    DosingService* m_dosing = nullptr;             // Null when relays are stopped by the boxes timers
+    RfidIoService* m_rfidService = nullptr;        // Null when each reader opens its own serial port
+    StartupSnapshot* m_snapshot = nullptr;         // Null when "snapshotFile" is empty
+    QTcpSocket* m_probe = nullptr;                 // Checking the database server answers before opening
+    std::atomic<bool> m_databaseConnected{false};
     QElapsedTimer m_timer;
 };
 
@@ -0,0 +1,104 @@
+# Sources shared by cowdetector and the tools built from the same code
+
+QT += network
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/gpiointerface.cpp \
+    $$PWD/detectorinterface.cpp \
+    $$PWD/debugdetector.cpp \
+    $$PWD/cowbox.cpp \
+    $$PWD/innovationreader.cpp \
+    $$PWD/cowdetector.cpp \
+    $$PWD/identificationcache.cpp \
+    $$PWD/consumptionledger.cpp \
+    $$PWD/databasewriter.cpp \
+    $$PWD/localjournal.cpp \
+    $$PWD/allocationcache.cpp \
+    $$PWD/logsink.cpp \
+    $$PWD/boxmanager.cpp \
+    $$PWD/boxparameterservice.cpp \
+    $$PWD/sqlstatements.cpp \
+    $$PWD/feedingpolicy.cpp \
+    $$PWD/clock.cpp \
+    $$PWD/simulatedclock.cpp \
+    $$PWD/debuggpio.cpp \
+    $$PWD/hardwarefactory.cpp \
+    $$PWD/feedingscheduler.cpp \
+    $$PWD/gpiobatch.cpp \
+    $$PWD/dosingservice.cpp \
+    $$PWD/simgpio.cpp \
+    $$PWD/scripteddetector.cpp \
+    $$PWD/frameparser.cpp \
+    $$PWD/presencetracker.cpp \
+    $$PWD/detectorregistry.cpp \
+    $$PWD/tcpreader.cpp \
+    $$PWD/metrics.cpp \
+    $$PWD/tracer.cpp \
+    $$PWD/signalnotifier.cpp \
+    $$PWD/configwatcher.cpp \
+    $$PWD/startupsnapshot.cpp \
+    $$PWD/startupphases.cpp \
+    $$PWD/boxstatefile.cpp
+
+HEADERS += \
+    $$PWD/gpiointerface.h \
+    $$PWD/detectorinterface.h \
+    $$PWD/debugdetector.h \
+    $$PWD/cowbox.h \
+    $$PWD/innovationreader.h \
+    $$PWD/cowdetector.h \
+    $$PWD/identificationcache.h \
+    $$PWD/consumptionledger.h \
+    $$PWD/databasewriter.h \
+    $$PWD/localjournal.h \
+    $$PWD/allocationcache.h \
+    $$PWD/logsink.h \
+    $$PWD/boxmanager.h \
+    $$PWD/boxparameters.h \
+    $$PWD/boxparameterservice.h \
+    $$PWD/sqlstatements.h \
+    $$PWD/feedingpolicy.h \
+    $$PWD/clock.h \
+    $$PWD/simulatedclock.h \
+    $$PWD/debuggpio.h \
+    $$PWD/hardwarefactory.h \
+    $$PWD/feedingscheduler.h \
+    $$PWD/gpiobatch.h \
+    $$PWD/dosingservice.h \
+    $$PWD/simgpio.h \
+    $$PWD/scripteddetector.h \
+    $$PWD/frameparser.h \
+    $$PWD/presencetracker.h \
+    $$PWD/detectorregistry.h \
+    $$PWD/tcpreader.h \
+    $$PWD/metrics.h \
+    $$PWD/tracer.h \
+    $$PWD/signalnotifier.h \
+    $$PWD/configwatcher.h \
+    $$PWD/startupsnapshot.h \
+    $$PWD/startupphases.h \
+    $$PWD/boxstatefile.h
+
+!win32 {
+SOURCES += \
+    $$PWD/gertboard/gb_common.c \
+    $$PWD/rpigpio.cpp \
+    $$PWD/gpiobank.cpp \
+
+HEADERS += \
+    $$PWD/gertboard/gb_common.h \
+    $$PWD/rpigpio.h \
+    $$PWD/gpiobank.h \
+}
+
+linux {
+SOURCES += \
+    $$PWD/cdevgpio.cpp \
+    $$PWD/rfidioservice.cpp
+
+HEADERS += \
+    $$PWD/cdevgpio.h \
+    $$PWD/rfidioservice.h
+}
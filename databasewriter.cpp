@@ -0,0 +1,395 @@
+#include "databasewriter.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QThread>
+#include <QTimer>
+
+#include "cowdetector.h"
+#include "sqlstatements.h"
+#include "metrics.h"
+
+/*
+ * Write behind of meals and identifications on a dedicated thread with its own connection,
+ * so relays driven by the boxes never wait for the database.
+ * Meal ids are reserved in advance from the meals sequence and handed to the boxes,
+ * each meal is then upserted by id : successive updates of a meal are coalesced in one row write.
+ * While Postgres is unreachable everything goes to the local journal, replayed on reconnect.
+ */
+
+static const int FlushDelay = 200;              // Coalesce all updates of a distribution
+static const int RetryDelay = 5000;
+static const int BatchSize = 100;               // Rows per INSERT statement
+static const int ReplayBatch = 500;             // Journal rows read at once, bounds memory during replay
+static const int MaxPendingLogs = 10000;
+static const int ReservedIds = 32;
+static const int ReserveThreshold = 8;
+static const qint64 MealIdRetention = 48 * 3600 * 1000ll;
+static const int PruneInterval = 3600 * 1000;
+
+DatabaseWriter::DatabaseWriter(const QJsonObject &config, QObject *parent) :
+    QObject(parent)
+  , m_config(config)
+  , m_thread(new QThread)
+  , m_connectionName("writer")
+  , m_backlog(config.value("readOnly").toBool(false) ? 0 : 1)
+  , m_readOnly(config.value("readOnly").toBool(false))
+  , m_nextLocalId(-QDateTime::currentMSecsSinceEpoch() * 100)       // Never reused by a later run, they may stay in the journal
+  , m_journal(config.value("journalFile").toString("cowdetector-journal.db"))
+{
+    m_thread->setObjectName("DatabaseWriter");
+    moveToThread(m_thread);
+}
+
+DatabaseWriter::~DatabaseWriter()
+{
+    stop();
+    delete m_thread;
+}
+
+qint64 DatabaseWriter::newMealId()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_reservedIds.isEmpty()) return m_reservedIds.takeFirst();
+    return m_nextLocalId--;
+}
+
+void DatabaseWriter::saveMeal(const MealRecord &meal)
+{
+    if (m_readOnly) return;
+    QMutexLocker locker(&m_mutex);
+    wakeUp();
+    m_pendingMeals.insert(meal.id, meal);
+}
+
+void DatabaseWriter::insertIdentification(const QString &rfid)
+{
+    if (m_readOnly) return;
+    QMutexLocker locker(&m_mutex);
+    wakeUp();
+    m_pendingIdentifications.append(rfid);
+}
+
+void DatabaseWriter::logEvent(const QString &level, const QString &message)
+{
+    if (m_readOnly) return;
+    LogRecord log;
+    log.level = level;
+    log.message = message;
+    log.time = QDateTime::currentDateTime();
+
+    QMutexLocker locker(&m_mutex);
+    wakeUp();
+    if (m_pendingLogs.count() >= MaxPendingLogs) m_pendingLogs.removeFirst();
+    m_pendingLogs.append(log);
+}
+
+void DatabaseWriter::start()
+{
+    if (m_readOnly) return;             // Meal ids are all local ones
+    m_thread->start();
+    QMetaObject::invokeMethod(this, "open", Qt::QueuedConnection);
+}
+
+void DatabaseWriter::stop()
+{
+    if (!m_thread->isRunning()) return;
+
+    // Write everything still pending before leaving
+    QMetaObject::invokeMethod(this, "flush", Qt::BlockingQueuedConnection);
+    QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
+    m_thread->quit();
+    m_thread->wait();
+}
+
+void DatabaseWriter::open()
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    connect(m_flushTimer, &QTimer::timeout, this, &DatabaseWriter::flush);
+
+    CowDetector::addDatabase(m_config, m_connectionName);
+    m_journal.open();
+    m_localIds = m_journal.mealIds();
+    if (!m_journal.isEmpty()) m_flushTimer->start(FlushDelay);
+    else {
+        m_backlog = 0;
+        emit backlogReplayed();
+    }
+    reconnect();
+}
+
+void DatabaseWriter::close()
+{
+    delete m_flushTimer;
+    m_flushTimer = nullptr;
+    m_journal.close();
+    SqlStatements::release(m_connectionName);
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+void DatabaseWriter::scheduleFlush()
+{
+    if (m_flushTimer && !m_flushTimer->isActive()) m_flushTimer->start(FlushDelay);
+}
+
+void DatabaseWriter::flush()
+{
+    QList<MealRecord> meals;
+    QStringList rfids;
+    QList<LogRecord> logs;
+    {
+        QMutexLocker locker(&m_mutex);
+        meals = m_pendingMeals.values();
+        m_pendingMeals.clear();
+        rfids.swap(m_pendingIdentifications);
+        logs.swap(m_pendingLogs);
+    }
+
+    // Journal first, it holds older states of the pending meals
+    bool backlog = m_backlog.load() != 0;
+    if (reconnect() && replayJournal() && write(meals, rfids, logs)) {
+        reserveMealIds();
+        pruneLocalIds();
+        if (backlog && m_backlog.load() == 0) emit backlogReplayed();
+        return;
+    }
+
+    // Database not reachable, keep everything on disk until it comes back
+    if (m_journal.append(meals, rfids, logs)) m_backlog = 1;
+    else {
+        requeue(meals, QStringList(), logs);
+        if (!rfids.isEmpty()) emit identificationsDropped(rfids);
+    }
+    if (m_flushTimer) m_flushTimer->start(RetryDelay);
+}
+
+void DatabaseWriter::wakeUp()
+{
+    if (m_pendingMeals.isEmpty() && m_pendingIdentifications.isEmpty() && m_pendingLogs.isEmpty()) {
+        QMetaObject::invokeMethod(this, "scheduleFlush", Qt::QueuedConnection);
+    }
+}
+
+bool DatabaseWriter::reconnect()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (db.isOpen()) return true;
+    if (m_reconnectTimer.isValid() && m_reconnectTimer.elapsed() < 20000) return false;
+    m_reconnectTimer.start();
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"writer\"");
+    reconnects->add();
+
+    if (!db.open()) {
+        qWarning() << "[DatabaseWriter] Database connection error : " << db.lastError().text();
+        return false;
+    }
+    SqlStatements::opened(db);
+    reserveMealIds();
+    return true;
+}
+
+void DatabaseWriter::reserveMealIds()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_reservedIds.count() >= ReserveThreshold) return;
+    }
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen()) return;
+
+    QSqlQuery* query = SqlStatements::prepared(db, "SELECT nextval(pg_get_serial_sequence('meals', 'id')) FROM generate_series(1, :count)");
+    query->bindValue(":count", ReservedIds);
+    if (!SqlStatements::exec(query)) {
+        qWarning() << "[DatabaseWriter] meal id reservation error : " << query->lastError().text();
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    while (query->next()) m_reservedIds.append(query->value(0).toLongLong());
+}
+
+bool DatabaseWriter::replayJournal()
+{
+    if (m_journal.isEmpty()) {
+        m_backlog = 0;
+        return true;
+    }
+
+    int replayed = 0;
+    forever {
+        qint64 lastLog = 0;
+        QList<MealRecord> meals = m_journal.meals(ReplayBatch);
+        QStringList rfids = m_journal.identifications(ReplayBatch);
+        QList<LogRecord> logs = m_journal.logs(ReplayBatch, &lastLog);
+        if (meals.isEmpty() && rfids.isEmpty() && logs.isEmpty()) break;
+
+        if (!write(meals, rfids, logs)) return false;
+        replayed += meals.count() + rfids.count() + logs.count();
+        bool removed = m_journal.removeMeals(meals) && m_journal.removeIdentifications(rfids);
+        if (!logs.isEmpty()) removed = m_journal.removeLogs(lastLog) && removed;
+        if (!removed) break;            // Replayed again later, meals are upserts
+    }
+
+    qDebug() << "[DatabaseWriter] Local journal replayed : " << replayed << "rows";
+    m_backlog = m_journal.isEmpty() ? 0 : 1;
+    return true;
+}
+
+bool DatabaseWriter::write(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs)
+{
+    if (writeIdentifications(rfids) && writeMeals(meals) && writeLogs(logs)) return true;
+
+    // Reopened at next flush
+    QSqlDatabase::database(m_connectionName, false).close();
+    return false;
+}
+
+bool DatabaseWriter::writeMeals(const QList<MealRecord> &meals)
+{
+    if (meals.isEmpty()) return true;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+
+    // Meals created without reserved id (sequence was not reachable) get their database id first
+    QList<qint64> unmapped;
+    for (const MealRecord &meal : meals) {
+        if (meal.id < 0 && !m_localIds.contains(meal.id) && !unmapped.contains(meal.id)) unmapped.append(meal.id);
+    }
+    if (!unmapped.isEmpty() && !mapLocalIds(unmapped)) return false;
+
+    // All meals are upserted by id in batches
+    QList<MealRecord> upserts;
+    for (MealRecord meal : meals) {
+        if (meal.id < 0) meal.id = m_localIds.value(meal.id);
+        upserts.append(meal);
+    }
+
+    db.transaction();
+    for (int first = 0, count; first < upserts.count(); first += count) {
+        count = SqlStatements::batchSize(upserts.count() - first, BatchSize);
+        QString sql = "INSERT INTO meals (id, cow, box, fooda, foodb, entry, exit) VALUES ";
+        for (int i = 0; i < count; i++) sql += i == 0 ? "(?, ?, ?, ?, ?, ?, ?)" : ", (?, ?, ?, ?, ?, ?, ?)";
+        sql += " ON CONFLICT (id) DO UPDATE SET fooda = EXCLUDED.fooda, foodb = EXCLUDED.foodb, exit = EXCLUDED.exit";
+
+        QSqlQuery* query = SqlStatements::prepared(db, sql);
+        int position = 0;
+        for (int i = first; i < first + count; i++) {
+            const MealRecord &meal = upserts.at(i);
+            query->bindValue(position++, meal.id);
+            query->bindValue(position++, meal.cow);
+            query->bindValue(position++, meal.box);
+            query->bindValue(position++, meal.foodA);
+            query->bindValue(position++, meal.foodB);
+            query->bindValue(position++, meal.entry);
+            query->bindValue(position++, meal.exit);
+        }
+        if (!SqlStatements::exec(query)) {
+            qWarning() << "[DatabaseWriter] meals upsert query error : " << query->lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        qWarning() << "[DatabaseWriter] meals commit error : " << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseWriter::mapLocalIds(const QList<qint64> &localIds)
+{
+    QSqlQuery* query = SqlStatements::prepared(QSqlDatabase::database(m_connectionName, false), "SELECT nextval(pg_get_serial_sequence('meals', 'id')) FROM generate_series(1, :count)");
+    query->bindValue(":count", localIds.count());
+    if (!SqlStatements::exec(query)) {
+        qWarning() << "[DatabaseWriter] meal id reservation error : " << query->lastError().text();
+        return false;
+    }
+    QHash<qint64, qint64> ids;
+    for (qint64 localId : localIds) {
+        if (!query->next()) return false;
+        ids.insert(localId, query->value(0).toLongLong());
+    }
+
+    // Kept on disk before any row is written, ids lost by a crash before are only a gap in the sequence
+    if (!m_journal.addMealIds(ids)) return false;
+    for (auto i = ids.constBegin(); i != ids.constEnd(); i++) m_localIds.insert(i.key(), i.value());
+    return true;
+}
+
+void DatabaseWriter::pruneLocalIds()
+{
+    if (m_pruneTimer.isValid() && m_pruneTimer.elapsed() < PruneInterval) return;
+    m_pruneTimer.start();
+
+    // Local ids are minus the creation time in ms times 100, a visit never lasts the retention
+    qint64 limit = -(QDateTime::currentMSecsSinceEpoch() - MealIdRetention) * 100;
+    if (!m_journal.pruneMealIds(limit)) return;
+    m_localIds = m_journal.mealIds();
+}
+
+bool DatabaseWriter::writeIdentifications(const QStringList &rfids)
+{
+    if (rfids.isEmpty()) return true;
+
+    // A tag written twice by a retry is skipped by the NOT EXISTS
+    for (int first = 0, count; first < rfids.count(); first += count) {
+        count = SqlStatements::batchSize(rfids.count() - first, BatchSize);
+        QString sql = "INSERT INTO identification (rfid) SELECT v.rfid FROM (VALUES ";
+        for (int i = 0; i < count; i++) sql += i == 0 ? "(CAST(? AS text))" : ", (?)";
+        sql += ") AS v(rfid) WHERE NOT EXISTS (SELECT 1 FROM identification i WHERE i.rfid = v.rfid)";
+
+        QSqlQuery* query = SqlStatements::prepared(QSqlDatabase::database(m_connectionName, false), sql);
+        for (int i = 0; i < count; i++) query->bindValue(i, rfids.at(first + i));
+        if (!SqlStatements::exec(query)) {
+            qWarning() << "[DatabaseWriter] identification insert query error : " << query->lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DatabaseWriter::writeLogs(const QList<LogRecord> &logs)
+{
+    if (logs.isEmpty()) return true;
+
+    // Log events kept offline are tagged with their time, logevents only knows insertion time
+    QDateTime recent = QDateTime::currentDateTime().addSecs(-60);
+    for (int first = 0, count; first < logs.count(); first += count) {
+        count = SqlStatements::batchSize(logs.count() - first, BatchSize);
+        QString sql = "INSERT INTO logevents (level, message) VALUES ";
+        for (int i = 0; i < count; i++) sql += i == 0 ? "(?, ?)" : ", (?, ?)";
+
+        QSqlQuery* query = SqlStatements::prepared(QSqlDatabase::database(m_connectionName, false), sql);
+        int position = 0;
+        for (int i = first; i < first + count; i++) {
+            const LogRecord &log = logs.at(i);
+            query->bindValue(position++, log.level);
+            if (log.time < recent) query->bindValue(position++, QString("[%1] %2").arg(log.time.toString(Qt::ISODate), log.message));
+            else query->bindValue(position++, log.message);
+        }
+        if (!SqlStatements::exec(query)) {
+            qWarning() << "[DatabaseWriter] logevents insert query error : " << query->lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void DatabaseWriter::requeue(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs)
+{
+    QMutexLocker locker(&m_mutex);
+
+    // A newer state of the same meal may have been queued meanwhile
+    for (const MealRecord &meal : meals) {
+        if (!m_pendingMeals.contains(meal.id)) m_pendingMeals.insert(meal.id, meal);
+    }
+    m_pendingIdentifications = rfids + m_pendingIdentifications;
+    m_pendingLogs = logs + m_pendingLogs;
+    while (m_pendingLogs.count() > MaxPendingLogs) m_pendingLogs.removeFirst();
+}
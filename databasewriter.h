@@ -0,0 +1,83 @@
+#ifndef DATABASEWRITER_H
+#define DATABASEWRITER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QMutex>
+#include <QHash>
+#include <QVector>
+#include <QElapsedTimer>
+#include <atomic>
+
+#include "localjournal.h"
+
+class QThread;
+class QTimer;
+
+class DatabaseWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DatabaseWriter(const QJsonObject &config, QObject *parent = 0);
+    ~DatabaseWriter();
+
+    // Thread safe, can be called from any box
+    qint64 newMealId();
+    void saveMeal(const MealRecord &meal);
+    void insertIdentification(const QString &rfid);
+    void logEvent(const QString &level, const QString &message);
+    bool hasBacklog() const { return m_backlog.load() != 0; }
+    bool isReadOnly() const { return m_readOnly; }
+
+    void start();
+    void stop();
+
+signals:
+    // Neither written nor kept in the journal, queued again at their next read
+    void identificationsDropped(const QStringList &rfids);
+    // The local journal is empty, everything given offline is in the database
+    void backlogReplayed();
+
+private slots:
+    void open();
+    void close();
+    void flush();
+    void scheduleFlush();
+
+private:
+    bool reconnect();
+    void reserveMealIds();
+    bool replayJournal();
+    bool write(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs);
+    bool writeMeals(const QList<MealRecord> &meals);
+    bool mapLocalIds(const QList<qint64> &localIds);
+    void pruneLocalIds();
+    bool writeIdentifications(const QStringList &rfids);
+    bool writeLogs(const QList<LogRecord> &logs);
+    void requeue(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs);
+    void wakeUp();
+
+private:
+    QJsonObject m_config;
+    QThread* m_thread;
+    QTimer* m_flushTimer = nullptr;
+    QString m_connectionName;
+    QElapsedTimer m_reconnectTimer;
+    std::atomic<int> m_backlog;                     // Some data waits in the local journal, unknown until it is opened
+    bool m_readOnly;                                // Replays and simulations, nothing is written
+
+    // Shared with box threads
+    QMutex m_mutex;
+    QHash<qint64, MealRecord> m_pendingMeals;       // Coalesced by meal id, last state wins
+    QStringList m_pendingIdentifications;
+    QList<LogRecord> m_pendingLogs;
+    QVector<qint64> m_reservedIds;
+    qint64 m_nextLocalId;
+
+    // Writer thread only
+    LocalJournal m_journal;
+    QHash<qint64, qint64> m_localIds;               // Local meal id to meals.id, same pairs as the journal
+    QElapsedTimer m_pruneTimer;
+};
+
+#endif // DATABASEWRITER_H
@@ -1,12 +1,18 @@
 #include "detectorinterface.h"
 
+#include "metrics.h"
+
 DetectorInterface::DetectorInterface(QObject *parent) : QObject(parent)
 {
 
 }
 
-void DetectorInterface::setId(QString id)
+void DetectorInterface::setId(QString id, qint64 readTime)
 {
+    if (!id.isEmpty()) {
+        m_lastRead = readTime > 0 ? readTime : Metrics::now();
+        emit tagRead(id);
+    }
     if (m_id == id)
         return;
 
@@ -13,15 +13,21 @@ public:
     virtual ~DetectorInterface() {}
 
     QString id() const { return m_id; }
+    // Time of the last tag read, Metrics::now() microseconds
+    qint64 lastRead() const { return m_lastRead; }
 
 signals:
     void idChanged(QString id);
+    // Each time a tag is read, even the same one
+    void tagRead(const QString &id);
 
 protected slots:
-    void setId(QString id);
+    // readTime is the Metrics::now() of the frame, now when not given
+    void setId(QString id, qint64 readTime = 0);
 
 private:
     QString m_id;
+    qint64 m_lastRead = 0;
 
 };
 
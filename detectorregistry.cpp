@@ -0,0 +1,66 @@
+#include "detectorregistry.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QtDebug>
+
+#include "innovationreader.h"
+#include "tcpreader.h"
+
+static QMutex registryMutex;
+static QHash<QString, DetectorRegistry::Creator> creators;
+static bool builtinsRegistered = false;
+
+static const char* DefaultType = "InnovationReader";     // Configurations written before the type was read
+
+static void registerBuiltins()
+{
+    if (builtinsRegistered) return;
+    builtinsRegistered = true;
+    creators.insert("InnovationReader", [](const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent) -> DetectorInterface* {
+        return new InnovationReader(config, detectorConfig, parent);
+    });
+    creators.insert("TcpReader", [](const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent) -> DetectorInterface* {
+        Q_UNUSED(config);
+        return new TcpReader(detectorConfig, parent);
+    });
+}
+
+void DetectorRegistry::registerType(const QString &type, Creator creator)
+{
+    QMutexLocker locker(&registryMutex);
+    registerBuiltins();
+    creators.insert(type, creator);
+}
+
+DetectorInterface* DetectorRegistry::create(const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent)
+{
+    QString type = detectorConfig.value("type").toString(DefaultType);
+    Creator creator;
+    {
+        QMutexLocker locker(&registryMutex);
+        registerBuiltins();
+        creator = creators.value(type);
+    }
+    if (!creator) {
+        qWarning() << "[DetectorRegistry] Unknown detector type : " << type << ", known types : " << types();
+        return nullptr;
+    }
+    return creator(config, detectorConfig, parent);
+}
+
+bool DetectorRegistry::isKnownType(const QJsonObject &detectorConfig)
+{
+    QMutexLocker locker(&registryMutex);
+    registerBuiltins();
+    return creators.contains(detectorConfig.value("type").toString(DefaultType));
+}
+
+QStringList DetectorRegistry::types()
+{
+    QMutexLocker locker(&registryMutex);
+    registerBuiltins();
+    QStringList names = creators.keys();
+    names.sort();
+    return names;
+}
@@ -0,0 +1,29 @@
+#ifndef DETECTORREGISTRY_H
+#define DETECTORREGISTRY_H
+
+#include <QJsonObject>
+#include <QStringList>
+#include <functional>
+
+class DetectorInterface;
+class QObject;
+
+// Detector types by the "type" of the box "detector" configuration
+class DetectorRegistry
+{
+public:
+    // config is the global configuration, for the hardware a detector needs besides its port
+    typedef std::function<DetectorInterface*(const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent)> Creator;
+
+    // Thread safe, types built in cowdetector are registered at first use
+    static void registerType(const QString &type, Creator creator);
+    static DetectorInterface* create(const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent);
+    static QStringList types();
+    // Type of the configuration registered, checked with the configuration before any box is built
+    static bool isKnownType(const QJsonObject &detectorConfig);
+
+private:
+    DetectorRegistry() {}
+};
+
+#endif // DETECTORREGISTRY_H
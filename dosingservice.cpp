@@ -0,0 +1,170 @@
+#include "dosingservice.h"
+
+#include <QThread>
+#include <QSocketNotifier>
+#include <QElapsedTimer>
+#include <QtDebug>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "gpiointerface.h"
+#include "gpiobatch.h"
+#include "tracer.h"
+
+/*
+ * Auger relays are switched off by a timerfd on CLOCK_MONOTONIC, armed at the earliest pending
+ * deadline and read by a thread doing nothing else. The time the relays really stayed on is
+ * measured around the register writes and given back to the box, which books the actual food.
+ * Relays are only touched through GpioInterface::directOff, a single register write safe from any thread.
+ */
+
+DosingService::DosingService(QObject *parent) :
+    QObject(parent)
+  , m_thread(new QThread)
+{
+#ifdef Q_OS_LINUX
+    m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timerFd < 0) qWarning() << "[DosingService] timerfd error : " << strerror(errno);
+#endif
+    if (m_timerFd < 0) return;
+
+    m_thread->setObjectName("DosingService");
+    moveToThread(m_thread);
+    m_thread->start(QThread::TimeCriticalPriority);
+    QMetaObject::invokeMethod(this, "open", Qt::BlockingQueuedConnection);
+}
+
+DosingService::~DosingService()
+{
+    if (m_thread->isRunning()) {
+        QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
+        m_thread->quit();
+        m_thread->wait();
+    }
+#ifdef Q_OS_LINUX
+    if (m_timerFd >= 0) ::close(m_timerFd);
+#endif
+    delete m_thread;
+}
+
+qint64 DosingService::monotonicNs()
+{
+#ifdef Q_OS_LINUX
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return qint64(now.tv_sec) * 1000000000 + now.tv_nsec;
+#else
+    static QElapsedTimer reference;
+    if (!reference.isValid()) reference.start();
+    return reference.nsecsElapsed();
+#endif
+}
+
+bool DosingService::accepts(const QList<GpioInterface*> &relays) const
+{
+    if (!isAvailable()) return false;
+    for (GpioInterface* relay : relays) {
+        if (!relay->hasDirectOff()) return false;
+    }
+    return true;
+}
+
+void DosingService::dose(const QList<GpioInterface*> &relays, qint64 startNs, int durationMs, QObject *receiver, std::function<void(qint64)> done,
+                         const char *traceName, const char *traceDetail)
+{
+    Dose dose;
+    dose.relays = relays;
+    dose.start = startNs;
+    dose.deadline = startNs + qint64(durationMs) * 1000000;
+    dose.receiver = receiver;
+    dose.done = done;
+    dose.traceName = traceName;
+    dose.traceDetail = traceDetail;
+
+    QMutexLocker locker(&m_mutex);
+    m_doses.insert(qMakePair(dose.deadline, m_sequence++), dose);
+    arm();
+}
+
+void DosingService::cancel(QObject *receiver)
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto i = m_doses.begin(); i != m_doses.end(); ) {
+        if (i->receiver == receiver) i = m_doses.erase(i);
+        else i++;
+    }
+    arm();
+}
+
+void DosingService::open()
+{
+#ifdef Q_OS_LINUX
+    // Not allowed without CAP_SYS_NICE, the thread then only competes with the box threads
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = 50;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) qDebug() << "[DosingService] No realtime priority : " << strerror(error);
+#endif
+
+    m_notifier = new QSocketNotifier(m_timerFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &DosingService::expired);
+}
+
+void DosingService::close()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+}
+
+void DosingService::expired()
+{
+#ifdef Q_OS_LINUX
+    quint64 expirations;
+    if (::read(m_timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        qWarning() << "[DosingService] timerfd read error : " << strerror(errno);
+    }
+#endif
+
+    // Relays are written under the lock, so a cancelled box never sees its relays touched afterwards
+    QMutexLocker locker(&m_mutex);
+    while (!m_doses.isEmpty() && m_doses.firstKey().first <= monotonicNs()) {
+        Dose dose = m_doses.take(m_doses.firstKey());
+        {
+            GpioBatch batch;
+            for (GpioInterface* relay : dose.relays) relay->directOff();
+        }
+        qint64 stop = monotonicNs();
+        if (dose.traceName) Tracer::instant(dose.traceName, dose.traceDetail);
+        m_maximumLateness = qMax(m_maximumLateness, stop - dose.deadline);
+
+        qint64 onTime = stop - dose.start;
+        std::function<void(qint64)> done = dose.done;
+        QMetaObject::invokeMethod(dose.receiver, [done, onTime]() { done(onTime); }, Qt::QueuedConnection);
+    }
+    arm();
+}
+
+void DosingService::arm()
+{
+#ifdef Q_OS_LINUX
+    // A zero value disarms the timer
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (!m_doses.isEmpty()) {
+        qint64 deadline = m_doses.firstKey().first;
+        spec.it_value.tv_sec = deadline / 1000000000;
+        spec.it_value.tv_nsec = deadline % 1000000000;
+    }
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        qWarning() << "[DosingService] timerfd arm error : " << strerror(errno);
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef DOSINGSERVICE_H
+#define DOSINGSERVICE_H
+
+#include <QObject>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QMutex>
+#include <functional>
+
+class QThread;
+class QSocketNotifier;
+class GpioInterface;
+
+// Switches dosing relays off at their deadline from a dedicated thread, whatever the load of the box threads
+class DosingService : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DosingService(QObject *parent = 0);
+    ~DosingService();
+
+    // Time base of the doses, nanoseconds of the monotonic clock
+    static qint64 monotonicNs();
+
+    // False when deadlines can't be kept by the dosing thread, boxes then stop relays from their own timers
+    bool isAvailable() const { return m_timerFd >= 0; }
+    bool accepts(const QList<GpioInterface*> &relays) const;
+
+    // Thread safe. Relays switched on at start are switched off at start + duration,
+    // then done is called in the receiver thread with the measured on-time.
+    // The trace instant (string literal or interned name) is recorded when the relays are really off.
+    void dose(const QList<GpioInterface*> &relays, qint64 startNs, int durationMs, QObject *receiver, std::function<void(qint64)> done,
+              const char *traceName = nullptr, const char *traceDetail = nullptr);
+    // Forget pending doses of the receiver, its relays are not touched anymore once returned
+    void cancel(QObject *receiver);
+
+    // Worst delay between a deadline and the relays switched off
+    qint64 maximumLateness() const { return m_maximumLateness; }
+
+private slots:
+    void open();
+    void close();
+    void expired();
+
+private:
+    void arm();
+
+private:
+    struct Dose {
+        QList<GpioInterface*> relays;
+        qint64 start;
+        qint64 deadline;
+        QObject* receiver;
+        std::function<void(qint64)> done;
+        const char* traceName;
+        const char* traceDetail;
+    };
+
+    QThread* m_thread;
+    QSocketNotifier* m_notifier = nullptr;
+    int m_timerFd = -1;
+    QMutex m_mutex;
+    QMap<QPair<qint64, quint64>, Dose> m_doses;     // By deadline and start order
+    quint64 m_sequence = 0;
+    qint64 m_maximumLateness = 0;
+};
+
+#endif // DOSINGSERVICE_H
@@ -0,0 +1,90 @@
+#include "feedingpolicy.h"
+
+static const int RelayMinimumTime = 1000;       // Don't distribute for less than 1 seconds to avoid problem on the relay
+static const int EatSpeedCheckDelay = 2000;
+static const int IdleCheckDelay = 5 * 60 * 1000;
+static const int MinimumPortion = 50;
+
+bool FeedingPolicy::isActive(const BoxParameters &parameters, const QTime &time)
+{
+    if (!parameters.idleStart1.isNull() && !parameters.idleStop1.isNull()) {
+        if (time > parameters.idleStart1 && time < parameters.idleStop1) return false;
+    }
+
+    if (!parameters.idleStart2.isNull() && !parameters.idleStop2.isNull()) {
+        if (time > parameters.idleStart2 && time < parameters.idleStop2) return false;
+    }
+
+    return true;
+}
+
+int FeedingPolicy::mealCount(const FoodAllocation &allocation)
+{
+    if (allocation.mealCount > 0) return allocation.mealCount;
+
+    int mealCount = 2;
+    if (allocation.foodA + allocation.foodB > 3000) mealCount = 4;
+    if (allocation.foodA + allocation.foodB > 6000) mealCount = 6;
+    return mealCount;
+}
+
+int FeedingPolicy::mealInterval(const FoodAllocation &allocation)
+{
+    int mealInterval = allocation.mealDelay * 60;
+    if (mealInterval <= 0) mealInterval = qRound(18.0 * 3600.0 / mealCount(allocation));     // spread on 18 hours
+    return mealInterval;
+}
+
+FeedingDecision FeedingPolicy::decide(const FeedingState &state, const BoxParameters &parameters, const QDateTime &now)
+{
+    FeedingDecision decision;
+    const FoodAllocation &allocation = state.allocation;
+    if ((allocation.foodA < 10) && (allocation.foodB < 10)) {
+        decision.action = FeedingDecision::ZeroAllocation;
+        return decision;
+    }
+    if (qFuzzyIsNull(parameters.foodSpeedA) || qFuzzyIsNull(parameters.foodSpeedB)) {
+        decision.action = FeedingDecision::ZeroSpeed;
+        return decision;
+    }
+
+    // Check the 6gr per second limit
+    qint64 mealDuration = state.entry.msecsTo(now);
+    if (mealDuration > 500 && mealDuration < (state.mealA + state.mealB) * 1000.0 / allocation.eatSpeed) {
+        decision.nextCheck = EatSpeedCheckDelay;
+        return decision;
+    }
+
+    // Compute food to give, in case food alloc < minimum give all remaining food
+    int mealCount = FeedingPolicy::mealCount(allocation);
+    qreal mealMinimum = parameters.mealMinimum;
+    qreal giveFoodA = qMax(0.0, allocation.foodA - state.eatenTodayA);
+    qreal giveFoodB = qMax(0.0, allocation.foodB - state.eatenTodayB);
+    if (giveFoodA > 2 * mealMinimum) giveFoodA = qMin(giveFoodA, (qreal)allocation.foodA / mealCount - state.eatenIntervalA);
+    if (giveFoodB > 2 * mealMinimum) giveFoodB = qMin(giveFoodB, (qreal)allocation.foodB / mealCount - state.eatenIntervalB);
+    if (giveFoodA > 2 * mealMinimum) giveFoodA = qMin(giveFoodA, (qreal)allocation.foodA / (allocation.foodA + allocation.foodB) * mealMinimum);
+    if (giveFoodB > 2 * mealMinimum) giveFoodB = qMin(giveFoodB, (qreal)allocation.foodB / (allocation.foodA + allocation.foodB) * mealMinimum);
+    giveFoodA = qRound(qMax(0.0, giveFoodA));
+    giveFoodB = qRound(qMax(0.0, giveFoodB));
+    if (giveFoodA + giveFoodB < MinimumPortion) {
+        // In the case the cow is still there without moving in 5 minutes
+        decision.nextCheck = IdleCheckDelay;
+        return decision;
+    }
+
+    int onTimeA = giveFoodA / parameters.foodSpeedA * 1000;
+    int onTimeB = giveFoodB / parameters.foodSpeedB * 1000;
+    decision.onTimeA = onTimeA > RelayMinimumTime ? onTimeA : 0;
+    decision.onTimeB = onTimeB > RelayMinimumTime ? onTimeB : 0;
+
+    // A portion too short for its relay is not given, so not booked : it stays due at the next check
+    decision.foodA = decision.onTimeA > 0 ? giveFoodA : 0.0;
+    decision.foodB = decision.onTimeB > 0 ? giveFoodB : 0.0;
+    if (decision.onTimeA == 0 && decision.onTimeB == 0) {
+        decision.nextCheck = IdleCheckDelay;
+        return decision;
+    }
+    decision.action = FeedingDecision::Dispense;
+    decision.nextCheck = 1000 + qMax(giveFoodA / parameters.foodSpeedA * 1000, giveFoodB / parameters.foodSpeedB * 1000);
+    return decision;
+}
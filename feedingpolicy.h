@@ -0,0 +1,52 @@
+#ifndef FEEDINGPOLICY_H
+#define FEEDINGPOLICY_H
+
+#include <QDateTime>
+
+#include "allocationcache.h"
+#include "boxparameters.h"
+
+// What the box knows about the cow in it when deciding
+struct FeedingState
+{
+    FoodAllocation allocation;
+    QDateTime entry;
+    qreal mealA = 0.0;                      // Given since entry in the box
+    qreal mealB = 0.0;
+    qreal eatenTodayA = 0.0;
+    qreal eatenTodayB = 0.0;
+    qreal eatenIntervalA = 0.0;             // Given in the last meal interval
+    qreal eatenIntervalB = 0.0;
+};
+
+struct FeedingDecision
+{
+    enum Action {
+        Dispense,
+        Wait,                               // Check again after nextCheck
+        ZeroAllocation,
+        ZeroSpeed
+    };
+
+    Action action = Wait;
+    qreal foodA = 0.0;                      // Only food whose relay runs, 0 otherwise
+    qreal foodB = 0.0;
+    int onTimeA = 0;                        // Relay on time in ms, 0 when below the relay minimum
+    int onTimeB = 0;
+    int nextCheck = 0;                      // ms
+};
+
+// Portion computation, without side effect so it can be benchmarked and tuned apart from the box
+class FeedingPolicy
+{
+public:
+    static bool isActive(const BoxParameters &parameters, const QTime &time);
+    static int mealCount(const FoodAllocation &allocation);
+    static int mealInterval(const FoodAllocation &allocation);     // Seconds
+    static FeedingDecision decide(const FeedingState &state, const BoxParameters &parameters, const QDateTime &now);
+
+private:
+    FeedingPolicy() {}
+};
+
+#endif // FEEDINGPOLICY_H
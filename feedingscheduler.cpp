@@ -0,0 +1,39 @@
+#include "feedingscheduler.h"
+
+#include "clock.h"
+
+FeedingScheduler::FeedingScheduler(QObject *parent) :
+    QObject(parent)
+  , m_timer(new ClockTimer(this))
+{
+    m_timer->setSingleShot(true);
+    connect(m_timer, &ClockTimer::timeout, this, &FeedingScheduler::timeout);
+}
+
+void FeedingScheduler::schedule(int ms)
+{
+    QDateTime deadline = Clock::instance()->now().addMSecs(qMax(0, ms));
+    if (m_timer->isActive()) {
+        m_coalesced++;
+        if (m_deadline <= deadline) return;
+    }
+
+    m_deadline = deadline;
+    m_timer->start(qMax(0, ms));
+}
+
+void FeedingScheduler::cancel()
+{
+    m_timer->stop();
+}
+
+bool FeedingScheduler::isPending() const
+{
+    return m_timer->isActive();
+}
+
+void FeedingScheduler::timeout()
+{
+    m_wakeups++;
+    emit due();
+}
@@ -0,0 +1,36 @@
+#ifndef FEEDINGSCHEDULER_H
+#define FEEDINGSCHEDULER_H
+
+#include <QObject>
+#include <QDateTime>
+
+class ClockTimer;
+
+// At most one pending food check per box, the earliest asked wins
+class FeedingScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FeedingScheduler(QObject *parent = 0);
+
+    void schedule(int ms);
+    void cancel();
+    bool isPending() const;
+
+    quint64 wakeups() const { return m_wakeups; }
+    quint64 coalesced() const { return m_coalesced; }
+
+signals:
+    void due();
+
+private slots:
+    void timeout();
+
+private:
+    ClockTimer* m_timer;
+    QDateTime m_deadline;
+    quint64 m_wakeups = 0;
+    quint64 m_coalesced = 0;                // Requests merged into an already pending check
+};
+
+#endif // FEEDINGSCHEDULER_H
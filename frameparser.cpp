@@ -0,0 +1,119 @@
+#include "frameparser.h"
+
+#include <string.h>
+
+/*
+ * Frames are searched from the ring tail : bytes before a STX are dropped, a STX seen before
+ * the ETX cuts the frame, a frame longer than MaximumFrame is given up. So the unparsed part
+ * never exceeds one frame and garbage on the line can't grow the buffer.
+ * The checksum is the XOR of the 5 id bytes, written as 2 hex characters after the id.
+ */
+
+static const char Stx = 0x02;
+static const char Etx = 0x03;
+
+FrameParser::FrameParser(bool checksum) :
+    m_checksum(checksum)
+{
+}
+
+char* FrameParser::writePointer(int *size)
+{
+    quint32 index = m_head & (Capacity - 1);
+    *size = qMin(Capacity - pending(), int(Capacity - index));
+    return m_ring + index;
+}
+
+void FrameParser::commit(int size)
+{
+    m_head += quint32(size);
+}
+
+void FrameParser::append(const char *data, int size)
+{
+    while (size > 0) {
+        int free;
+        char* destination = writePointer(&free);
+        if (free == 0) {
+            // Oldest bytes lost, only when frames are not taken out
+            m_tail++;
+            m_statistics.droppedBytes++;
+            continue;
+        }
+        int count = qMin(free, size);
+        memcpy(destination, data, size_t(count));
+        commit(count);
+        data += count;
+        size -= count;
+    }
+}
+
+bool FrameParser::next(char id[IdLength])
+{
+    forever {
+        while (m_tail != m_head && at(m_tail) != Stx) {
+            m_tail++;
+            m_statistics.droppedBytes++;
+        }
+        if (m_tail == m_head) return false;
+
+        quint32 position = m_tail + 1;
+        while (position != m_head && position - m_tail <= MaximumFrame && at(position) != Etx && at(position) != Stx) position++;
+        if (position - m_tail > MaximumFrame) {
+            // No ETX in sight, search the next STX
+            m_statistics.framingErrors++;
+            m_statistics.droppedBytes++;
+            m_tail++;
+            continue;
+        }
+        if (position == m_head) return false;       // Rest of the frame not received yet
+        if (at(position) == Stx) {
+            m_statistics.framingErrors++;
+            m_statistics.droppedBytes += position - m_tail;
+            m_tail = position;
+            continue;
+        }
+
+        quint32 start = m_tail + 1;
+        m_tail = position + 1;
+        if (decode(start, position, id)) {
+            m_statistics.frames++;
+            return true;
+        }
+    }
+}
+
+bool FrameParser::decode(quint32 start, quint32 end, char id[IdLength])
+{
+    // CR LF or anything after the checksum is ignored
+    if (end - start < IdLength + 2) {
+        m_statistics.framingErrors++;
+        return false;
+    }
+
+    int checksum = 0;
+    for (int i = 0; i < IdLength + 2; i += 2) {
+        int high = hexValue(at(start + i));
+        int low = hexValue(at(start + i + 1));
+        if (high < 0 || low < 0) {
+            m_statistics.framingErrors++;
+            return false;
+        }
+        if (i < IdLength) checksum ^= high << 4 | low;
+        else if (m_checksum && checksum != (high << 4 | low)) {
+            m_statistics.checksumErrors++;
+            return false;
+        }
+    }
+
+    for (int i = 0; i < IdLength; i++) id[i] = at(start + i);
+    return true;
+}
+
+int FrameParser::hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
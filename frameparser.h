@@ -0,0 +1,50 @@
+#ifndef FRAMEPARSER_H
+#define FRAMEPARSER_H
+
+#include <QtGlobal>
+
+// Incremental parser of the Innovation reader frames : STX, 10 ASCII hex id, 2 ASCII hex checksum, CR LF, ETX.
+// Bytes are read straight into a fixed ring, every complete frame is extracted in place.
+class FrameParser
+{
+public:
+    enum {
+        Capacity = 256,                     // Power of two
+        IdLength = 10,
+        MaximumFrame = 32                   // Longer without ETX is garbage
+    };
+
+    struct Statistics {
+        quint64 frames = 0;
+        quint64 checksumErrors = 0;
+        quint64 framingErrors = 0;          // Truncated, too long or not hex frames
+        quint64 droppedBytes = 0;           // Outside frames, or lost when the ring was full
+    };
+
+    explicit FrameParser(bool checksum = true);
+
+    // Free contiguous space to read into, then the number of bytes actually read
+    char* writePointer(int *size);
+    void commit(int size);
+    void append(const char *data, int size);
+
+    // Next valid frame, false once no complete frame is left
+    bool next(char id[IdLength]);
+
+    const Statistics& statistics() const { return m_statistics; }
+    int pending() const { return int(m_head - m_tail); }
+
+private:
+    char at(quint32 position) const { return m_ring[position & (Capacity - 1)]; }
+    bool decode(quint32 start, quint32 end, char id[IdLength]);
+    static int hexValue(char c);
+
+private:
+    char m_ring[Capacity];
+    quint32 m_head = 0;                     // Free running positions, the ring index is masked
+    quint32 m_tail = 0;
+    bool m_checksum;
+    Statistics m_statistics;
+};
+
+#endif // FRAMEPARSER_H
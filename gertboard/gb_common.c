@@ -357,3 +357,16 @@ int readGpio(int pin)
     unsigned int b = GPIO_IN0;
     return b & (1 << pin);
 }
+
+// All bank 0 pins at once
+unsigned int readAllGpio()
+{
+    return GPIO_IN0;
+}
+
+// Pins of a mask switch together, set first then clear
+void writeGpioMasks(unsigned int set, unsigned int clear)
+{
+    if (set) GPIO_SET0 = set;
+    if (clear) GPIO_CLR0 = clear;
+}
@@ -61,6 +61,8 @@ void setPullType(int pin, int pull);
 void setGpio(int pin);
 void clearGpio(int pin);
 int readGpio(int pin);
+unsigned int readAllGpio();
+void writeGpioMasks(unsigned int set, unsigned int clear);
 
 //
 //  UART 0
@@ -0,0 +1,109 @@
+#include "gpiobank.h"
+
+#include <QtDebug>
+#include <QThread>
+#include <QPointer>
+
+#include "clock.h"
+#include "rpigpio.h"
+#include "metrics.h"
+
+extern "C" {
+#include "gertboard/gb_common.h"
+}
+
+/*
+ * One timer for every polled input of every box : GPIO_IN0 is read once per tick
+ * and only inputs whose pin changed are notified. The tick is the shortest poll
+ * interval asked, so wakeups don't grow with the number of boxes.
+ */
+
+GpioBank* GpioBank::m_instance = nullptr;
+
+GpioBank::GpioBank(QObject *parent) :
+    QObject(parent)
+  , m_timer(new ClockTimer(this))
+{
+    m_timer->setSingleShot(false);
+    connect(m_timer, &ClockTimer::timeout, this, &GpioBank::tick);
+}
+
+void GpioBank::create()
+{
+    if (!m_instance) m_instance = new GpioBank;
+}
+
+void GpioBank::destroy()
+{
+    delete m_instance;
+    m_instance = nullptr;
+}
+
+void GpioBank::addInput(RpiGpio *input, int gpio, int pollInterval)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_inputs.insert(input, gpio);
+        m_intervals.insert(input, pollInterval);
+    }
+    QMetaObject::invokeMethod(this, "updateInterval", Qt::QueuedConnection);
+}
+
+void GpioBank::removeInput(RpiGpio *input)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_inputs.remove(input);
+        m_intervals.remove(input);
+    }
+    QMetaObject::invokeMethod(this, "updateInterval", Qt::QueuedConnection);
+}
+
+void GpioBank::updateInterval()
+{
+    int interval = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (int inputInterval : m_intervals) {
+            if (interval == 0 || inputInterval < interval) interval = inputInterval;
+        }
+    }
+
+    if (interval <= 0) m_timer->stop();
+    else if (!m_timer->isActive() || m_timer->interval() != interval) m_timer->start(interval);
+}
+
+void GpioBank::tick()
+{
+    // Distance to the expected tick, the timer is late when the main thread is busy
+    static MetricHistogram* jitter = Metrics::histogram("cowdetector_gpio_poll_jitter_seconds", "Difference between the input poll interval and the actual one");
+    qint64 now = Metrics::now();
+    if (m_lastTick > 0) jitter->observe(qAbs(now - m_lastTick - qint64(m_timer->interval()) * 1000));
+    m_lastTick = now;
+
+    m_ticks++;
+    unsigned int sample = readAllGpio();
+    unsigned int changed = m_sampled ? sample ^ m_lastSample : ~0u;
+    m_lastSample = sample;
+    m_sampled = true;
+    if (!changed) return;
+
+    // Inputs of worker threads get the change posted while they can't be deleted,
+    // the ones of this thread are called once the lock is released
+    QList<QPair<QPointer<RpiGpio>, bool>> levels;
+    {
+        QMutexLocker locker(&m_mutex);
+        for (auto i = m_inputs.constBegin(); i != m_inputs.constEnd(); i++) {
+            unsigned int bit = 1u << i.value();
+            if (!(changed & bit)) continue;
+            RpiGpio* input = i.key();
+            bool high = sample & bit;
+            if (input->thread() == thread()) levels.append(qMakePair(QPointer<RpiGpio>(input), high));
+            else QMetaObject::invokeMethod(input, [input, high]() { input->setLevel(high); }, Qt::QueuedConnection);
+        }
+    }
+
+    for (const auto &level : levels) {
+        if (level.first) level.first->setLevel(level.second);
+    }
+}
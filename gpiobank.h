@@ -0,0 +1,45 @@
+#ifndef GPIOBANK_H
+#define GPIOBANK_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+
+class ClockTimer;
+class RpiGpio;
+
+// Samples all polled inputs with one register read per tick and fans the changes out
+class GpioBank : public QObject
+{
+    Q_OBJECT
+public:
+    static GpioBank* instance() { return m_instance; }
+    static void create();
+    static void destroy();
+
+    // Thread safe, inputs are notified in their own thread
+    void addInput(RpiGpio *input, int gpio, int pollInterval);
+    void removeInput(RpiGpio *input);
+
+    quint64 ticks() const { return m_ticks; }
+
+private:
+    explicit GpioBank(QObject *parent = 0);
+
+private slots:
+    void tick();
+    void updateInterval();
+
+private:
+    static GpioBank* m_instance;
+    QMutex m_mutex;
+    QHash<RpiGpio*, int> m_inputs;          // Input to its gpio
+    QHash<RpiGpio*, int> m_intervals;
+    ClockTimer* m_timer;
+    unsigned int m_lastSample = 0;
+    bool m_sampled = false;
+    quint64 m_ticks = 0;
+    qint64 m_lastTick = 0;                  // Metrics::now()
+};
+
+#endif // GPIOBANK_H
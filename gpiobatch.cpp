@@ -0,0 +1,38 @@
+#include "gpiobatch.h"
+
+static thread_local GpioBatch* currentBatch = nullptr;
+static GpioBatch::Writer batchWriter = nullptr;
+
+GpioBatch::GpioBatch() :
+    m_outer(currentBatch)
+{
+    currentBatch = this;
+}
+
+GpioBatch::~GpioBatch()
+{
+    currentBatch = m_outer;
+
+    // Changes of nested batches are written by the outer one
+    if (m_outer) {
+        m_outer->m_set = (m_outer->m_set & ~m_clear) | m_set;
+        m_outer->m_clear = (m_outer->m_clear & ~m_set) | m_clear;
+        return;
+    }
+    if ((m_set || m_clear) && batchWriter) batchWriter(m_set, m_clear);
+}
+
+GpioBatch* GpioBatch::current()
+{
+    return currentBatch;
+}
+
+void GpioBatch::setWriter(Writer writer)
+{
+    batchWriter = writer;
+}
+
+GpioBatch::Writer GpioBatch::writer()
+{
+    return batchWriter;
+}
@@ -0,0 +1,32 @@
+#ifndef GPIOBATCH_H
+#define GPIOBATCH_H
+
+#include <QtGlobal>
+
+// Output changes made in its scope by the current thread are written at once when it ends,
+// paired relays switch together with a single set and a single clear register write
+class GpioBatch
+{
+public:
+    GpioBatch();
+    ~GpioBatch();
+
+    // Null when no batch is open in this thread
+    static GpioBatch* current();
+
+    void set(int gpio) { m_set |= 1u << gpio; m_clear &= ~(1u << gpio); }
+    void clear(int gpio) { m_clear |= 1u << gpio; m_set &= ~(1u << gpio); }
+
+    // Register write of the gpio backend, without one outputs are written one by one
+    typedef void (*Writer)(unsigned int set, unsigned int clear);
+    static void setWriter(Writer writer);
+    static Writer writer();
+
+private:
+    Q_DISABLE_COPY(GpioBatch)
+    GpioBatch* m_outer;
+    unsigned int m_set = 0;
+    unsigned int m_clear = 0;
+};
+
+#endif // GPIOBATCH_H
@@ -1,6 +1,6 @@
 #include "gpiointerface.h"
 
-#include <QTimer>
+#include "clock.h"
 
 GpioInterface::GpioInterface(GpioType type, PullType pullType, QObject *parent) :
     QObject(parent)
@@ -32,6 +32,6 @@ void GpioInterface::toggle()
 void GpioInterface::pulse(int ms)
 {
     setOn(true);
-    QTimer::singleShot(ms, this, SLOT(reset()));
+    Clock::singleShot(ms, this, SLOT(reset()));
 }
 
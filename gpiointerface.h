@@ -32,6 +32,10 @@ public:
     GpioType type() const { return m_type; }
     PullType pullType() const { return m_pullType; }
 
+    // Outputs able to switch off the hardware from any thread, the state follows with setOn(false)
+    virtual bool hasDirectOff() const { return false; }
+    virtual void directOff() {}
+
 signals:
     void onChanged(bool on);
 
@@ -0,0 +1,104 @@
+#include "hardwarefactory.h"
+
+#include "debuggpio.h"
+#include "debugdetector.h"
+#include "simgpio.h"
+#include "scripteddetector.h"
+#include "detectorregistry.h"
+
+#ifndef Q_OS_WIN
+#include "rpigpio.h"
+#endif
+#ifdef Q_OS_LINUX
+#include "cdevgpio.h"
+#endif
+
+#include <QDir>
+#include <QtDebug>
+
+bool HardwareFactory::isSimulated(const QJsonObject &config)
+{
+    return gpioBackend(config) != "rpi";
+}
+
+QString HardwareFactory::gpioBackend(const QJsonObject &config)
+{
+    if (config.value("simulation").toBool(false)) return "debug";
+#ifdef Q_OS_WIN
+    QString backend = config.value("gpioBackend").toString("debug");
+    return backend == "sim" ? backend : "debug";
+#else
+    return config.value("gpioBackend").toString("rpi");
+#endif
+}
+
+bool HardwareFactory::isValidBackend(const QJsonObject &config)
+{
+    // A typo must not drive the relays of a real box, nor silently simulate them
+    QString backend = config.value("gpioBackend").toString("rpi");
+    if (backend == "rpi" || backend == "debug" || backend == "sim") return true;
+    qWarning() << "[HardwareFactory] Unknown gpioBackend, expected rpi, debug or sim : " << backend;
+    return false;
+}
+
+void HardwareFactory::cleanUp()
+{
+    ScriptedDetector::shutdown();
+}
+
+static QString simGpioFile(const QJsonObject &config)
+{
+    return config.value("simGpioFile").toString(QDir::temp().filePath("cowdetector-gpio"));
+}
+
+GpioInterface* HardwareFactory::output(const QJsonObject &config, const QString &name, int gpio, QObject *parent)
+{
+#ifndef Q_OS_WIN
+    if (!isSimulated(config)) return new RpiGpio(gpio, parent);
+#endif
+    if (gpioBackend(config) == "sim") {
+        SimGpio* output = new SimGpio(simGpioFile(config), gpio, parent);
+        if (output->isValid()) return output;
+        qWarning() << "[HardwareFactory] " << name << " : no simulated gpio " << gpio;
+        delete output;
+    }
+    return new DebugGpio(name, parent);
+}
+
+GpioInterface* HardwareFactory::input(const QJsonObject &config, const QString &name, int gpio, GpioInterface::PullType pullType, int pollInterval, QObject *parent)
+{
+#ifdef Q_OS_LINUX
+    // Edge events from the GPIO character device, polling stays the fallback
+    if (!isSimulated(config) && config.value("gpioInputBackend").toString() == "cdev") {
+        CdevGpio* input = new CdevGpio(config.value("gpioChip").toString("/dev/gpiochip0"), gpio, pullType, config.value("gpioDebounce").toInt(10), parent);
+        if (input->isValid()) return input;
+        qWarning() << "[HardwareFactory] " << name << " : GPIO character device not available, polling gpio " << gpio;
+        delete input;
+    }
+#endif
+#ifndef Q_OS_WIN
+    if (!isSimulated(config)) return new RpiGpio(gpio, pullType, pollInterval, parent);
+#endif
+    if (gpioBackend(config) == "sim") {
+        SimGpio* input = new SimGpio(simGpioFile(config), gpio, pullType, pollInterval, parent);
+        if (input->isValid()) return input;
+        qWarning() << "[HardwareFactory] " << name << " : no simulated gpio " << gpio;
+        delete input;
+    }
+    return new DebugGpio(name, parent);
+}
+
+DetectorInterface* HardwareFactory::detector(const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent)
+{
+    if (!isSimulated(config)) {
+        // Types are checked with the configuration, a box which would never see a cow is not started
+        DetectorInterface* detector = DetectorRegistry::create(config, detectorConfig, parent);
+        if (!detector) qFatal("[HardwareFactory] No detector for type %s", qPrintable(detectorConfig.value("type").toString()));
+        return detector;
+    }
+    if (gpioBackend(config) == "sim") {
+        QString name = detectorConfig.value("simName").toString(detectorConfig.value("port").toString());
+        return new ScriptedDetector(config.value("simDetectorServer").toString("cowdetector-sim"), name, parent);
+    }
+    return new DebugDetector(parent);
+}
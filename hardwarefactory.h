@@ -0,0 +1,33 @@
+#ifndef HARDWAREFACTORY_H
+#define HARDWAREFACTORY_H
+
+#include <QJsonObject>
+
+#include "gpiointerface.h"
+
+class DetectorInterface;
+
+// Creates box hardware, simulated on Windows, when the configuration sets "simulation": true
+// or a "gpioBackend" other than "rpi", any other value is refused at start :
+//   "debug" : in memory gpio and detectors, driven by the QML panel or the replay tool
+//   "sim"   : gpio bank in a mapped file ("simGpioFile") and detectors driven through
+//             a local socket ("simDetectorServer"), for test drivers in other processes
+// Real detectors are created by the DetectorRegistry from the "type" of their configuration
+// Inputs use the GPIO character device with "gpioInputBackend": "cdev" ("gpioChip", "gpioDebounce" in ms)
+class HardwareFactory
+{
+public:
+    static bool isSimulated(const QJsonObject &config);
+    static QString gpioBackend(const QJsonObject &config);
+    static bool isValidBackend(const QJsonObject &config);
+    static void cleanUp();
+
+    static GpioInterface* output(const QJsonObject &config, const QString &name, int gpio, QObject *parent);
+    static GpioInterface* input(const QJsonObject &config, const QString &name, int gpio, GpioInterface::PullType pullType, int pollInterval, QObject *parent);
+    static DetectorInterface* detector(const QJsonObject &config, const QJsonObject &detectorConfig, QObject *parent);
+
+private:
+    HardwareFactory() {}
+};
+
+#endif // HARDWAREFACTORY_H
@@ -0,0 +1,173 @@
+#include "identificationcache.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QTimer>
+
+#include "cowdetector.h"
+#include "databasewriter.h"
+
+/*
+ * Keep the whole identification table in memory, so a cow entering a box is a hash probe.
+ * The cache is reloaded when Postgres notifies a change on the "identification" channel,
+ * it needs this trigger on the database :
+ *
+ *   CREATE FUNCTION notify_identification() RETURNS trigger AS $$
+ *   BEGIN NOTIFY identification; RETURN NULL; END; $$ LANGUAGE plpgsql;
+ *   CREATE TRIGGER identification_notify AFTER INSERT OR UPDATE OR DELETE ON identification
+ *   FOR EACH STATEMENT EXECUTE PROCEDURE notify_identification();
+ *
+ * Without the trigger (or when the subscription failed) the table is polled.
+ */
+
+static const char* NotificationChannel = "identification";
+static const int NotifiedPollInterval = 10 * 60 * 1000;     // Safety reload when notifications are working
+static const int PollInterval = 60 * 1000;
+
+IdentificationCache::IdentificationCache(QObject *parent) :
+    QObject(parent)
+  , m_pollTimer(new QTimer(this))
+{
+    m_pollTimer->setSingleShot(false);
+    m_pollTimer->setInterval(PollInterval);
+    connect(m_pollTimer, &QTimer::timeout, this, &IdentificationCache::reload);
+}
+
+bool IdentificationCache::lookup(const QString &rfid, int *cow, int *card)
+{
+    QMutexLocker locker(&m_mutex);
+    auto i = m_identifications.constFind(rfid);
+    if (i != m_identifications.constEnd()) {
+        *cow = i->cow;
+        *card = i->card;
+        return true;
+    }
+
+    *cow = -1;
+    *card = -1;
+
+    // Create the row with the detected Id, so we could fill it with cow numbers
+    if (!m_insertedTags.contains(rfid)) {
+        m_insertedTags.insert(rfid);
+        CowDetector::instance()->writer()->insertIdentification(rfid);
+    }
+    return false;
+}
+
+int IdentificationCache::count()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_identifications.count();
+}
+
+bool IdentificationCache::loadSnapshot(const QSqlDatabase &db)
+{
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT rfid, cow, card FROM identification")) {
+        qWarning() << "[IdentificationCache] snapshot query error : " << query.lastError().text();
+        return false;
+    }
+
+    QHash<QString, Identification> identifications;
+    while (query.next()) {
+        Identification identification;
+        identification.cow = query.value(1).toInt();
+        identification.card = query.value(2).toInt();
+        identifications.insert(query.value(0).toString(), identification);
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_identifications.isEmpty()) return true;      // Already loaded from the database
+        m_identifications.swap(identifications);
+        for (auto i = m_identifications.constBegin(); i != m_identifications.constEnd(); i++) m_insertedTags.insert(i.key());
+    }
+    emit changed();
+    return true;
+}
+
+bool IdentificationCache::saveSnapshot(const QSqlDatabase &db)
+{
+    QHash<QString, Identification> identifications;
+    {
+        QMutexLocker locker(&m_mutex);
+        identifications = m_identifications;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("DELETE FROM identification")) {
+        qWarning() << "[IdentificationCache] snapshot delete error : " << query.lastError().text();
+        return false;
+    }
+    query.prepare("INSERT INTO identification (rfid, cow, card) VALUES (?, ?, ?)");
+    for (auto i = identifications.constBegin(); i != identifications.constEnd(); i++) {
+        query.addBindValue(i.key());
+        query.addBindValue(i->cow);
+        query.addBindValue(i->card);
+        if (!query.exec()) {
+            qWarning() << "[IdentificationCache] snapshot insert error : " << query.lastError().text();
+            return false;
+        }
+    }
+    return true;
+}
+
+void IdentificationCache::reload()
+{
+    QSqlDatabase db = QSqlDatabase::database(QSqlDatabase::defaultConnection, false);
+    if (!db.isOpen()) return;
+    subscribe();
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT rfid, cownumber, cardnumber FROM identification")) {
+        qWarning() << "[IdentificationCache] identification table query error : " << query.lastError().text();
+        return;
+    }
+
+    QHash<QString, Identification> identifications;
+    while (query.next()) {
+        Identification identification;
+        identification.cow = query.value(1).isNull() ? -1 : query.value(1).toInt();
+        identification.card = query.value(2).isNull() ? -1 : query.value(2).toInt();
+        identifications.insert(query.value(0).toString(), identification);
+    }
+    {
+        QMutexLocker locker(&m_mutex);
+        m_identifications.swap(identifications);
+        for (auto i = m_identifications.constBegin(); i != m_identifications.constEnd(); i++) m_insertedTags.insert(i.key());
+    }
+    emit changed();
+}
+
+void IdentificationCache::forgetInserted(const QStringList &rfids)
+{
+    QMutexLocker locker(&m_mutex);
+    for (const QString &rfid : rfids) m_insertedTags.remove(rfid);
+}
+
+void IdentificationCache::notificationReceived(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload)
+{
+    Q_UNUSED(source);
+    Q_UNUSED(payload);
+    if (name == NotificationChannel) reload();
+}
+
+void IdentificationCache::subscribe()
+{
+    QSqlDriver* driver = QSqlDatabase::database().driver();
+    if (!driver->hasFeature(QSqlDriver::EventNotifications)) {
+        if (!m_pollTimer->isActive()) m_pollTimer->start(PollInterval);
+        return;
+    }
+
+    // Subscriptions are lost when the connection is reopened
+    if (driver->subscribedToNotifications().contains(NotificationChannel)) return;
+    connect(driver, SIGNAL(notification(QString,QSqlDriver::NotificationSource,QVariant)),
+            this, SLOT(notificationReceived(QString,QSqlDriver::NotificationSource,QVariant)), Qt::UniqueConnection);
+    if (driver->subscribeToNotification(NotificationChannel)) m_pollTimer->start(NotifiedPollInterval);
+    else {
+        qWarning() << "[IdentificationCache] Impossible to subscribe to identification notifications, polling table.";
+        m_pollTimer->start(PollInterval);
+    }
+}
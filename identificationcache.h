@@ -0,0 +1,53 @@
+#ifndef IDENTIFICATIONCACHE_H
+#define IDENTIFICATIONCACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QSqlDriver>
+#include <QMutex>
+
+class QTimer;
+class QSqlDatabase;
+
+class IdentificationCache : public QObject
+{
+    Q_OBJECT
+public:
+    explicit IdentificationCache(QObject *parent = 0);
+
+    // Return true when the rfid is known, unknown tags are queued once for insertion. Thread safe.
+    bool lookup(const QString &rfid, int *cow, int *card);
+    int count();
+
+    // Tags known at the last snapshot, read at start before the database answers
+    bool loadSnapshot(const QSqlDatabase &db);
+    bool saveSnapshot(const QSqlDatabase &db);
+
+signals:
+    void changed();
+
+public slots:
+    void reload();
+    // The insertion failed, the tag is queued again when it is read
+    void forgetInserted(const QStringList &rfids);
+
+private slots:
+    void notificationReceived(const QString &name, QSqlDriver::NotificationSource source, const QVariant &payload);
+
+private:
+    void subscribe();
+
+private:
+    struct Identification {
+        int cow = -1;
+        int card = -1;
+    };
+
+    QMutex m_mutex;
+    QHash<QString, Identification> m_identifications;
+    QSet<QString> m_insertedTags;           // Unknown tags already inserted (or queued), never insert twice
+    QTimer* m_pollTimer;
+};
+
+#endif // IDENTIFICATIONCACHE_H
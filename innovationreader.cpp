@@ -4,10 +4,12 @@
 #include <QtDebug>
 
 #include "gpiointerface.h"
-#ifdef Q_OS_WIN
-#include "debuggpio.h"
-#else
-#include "rpigpio.h"
+#include "hardwarefactory.h"
+#include "cowdetector.h"
+#include "metrics.h"
+#include "tracer.h"
+#ifdef Q_OS_LINUX
+#include "rfidioservice.h"
 #endif
 
 /*
@@ -15,21 +17,29 @@
  * It will be reset to empty string when the tag in range is falling back to zero.
  */
 
-InnovationReader::InnovationReader(const QJsonObject &config, QObject *parent) :
+InnovationReader::InnovationReader(const QJsonObject &globalConfig, const QJsonObject &config, QObject *parent) :
     DetectorInterface(parent),
     m_config(config),
-    m_serial(new QSerialPort(this))
+    m_parser(config.value("checksum").toBool(true)),
+    m_frames(Metrics::counter("cowdetector_rfid_frames_total", "Valid frames read from RFID readers", QString("port=\"%1\"").arg(config.value("port").toString()))),
+    m_errors(Metrics::counter("cowdetector_rfid_errors_total", "Checksum and framing errors of RFID readers", QString("port=\"%1\"").arg(config.value("port").toString())))
 {
-#ifdef Q_OS_WIN
-    m_tagInRange = new DebugGpio("CardPresent", this);
-#else
     // TagInRange is pull down so there is no tag in range when not connected
-    m_tagInRange = new RpiGpio(m_config.value("gpioTagInRange").toInt(17), GpioInterface::NoPull, 250, this);
-#endif
+    m_tagInRange = HardwareFactory::input(globalConfig, "CardPresent", m_config.value("gpioTagInRange").toInt(17), GpioInterface::NoPull, 250, this);
     connect(m_tagInRange, &GpioInterface::onChanged, this, [this](bool on) {
         if (!on) setId(QString());
     });
 
+#ifdef Q_OS_LINUX
+    // Read with the other readers in the RFID I/O thread
+    RfidIoService* service = CowDetector::instance()->rfidService();
+    if (service) {
+        service->addReader(m_config.value("port").toString(), this, m_config.value("checksum").toBool(true));
+        return;
+    }
+#endif
+
+    m_serial = new QSerialPort(this);
     m_serial->setPortName(m_config.value("port").toString());
     m_serial->setBaudRate(QSerialPort::Baud9600);
     m_serial->setParity(QSerialPort::NoParity);
@@ -39,27 +49,42 @@ InnovationReader::InnovationReader(const QJsonObject &config, QObject *parent) :
     qDebug() << "Innovation reader connected on port : " << m_serial->portName();
 }
 
-void InnovationReader::readData()
+InnovationReader::~InnovationReader()
 {
-    m_buffer.append(m_serial->readAll());
-//    qDebug() << "Innovation reader read data : " << m_buffer << m_buffer.toHex();
+#ifdef Q_OS_LINUX
+    if (!m_serial && CowDetector::instance()->rfidService()) CowDetector::instance()->rfidService()->removeReader(this);
+#endif
+}
 
-    int endText = m_buffer.indexOf(0x03);           // ETX
-    if (endText == -1) return;
-    QByteArray data = m_buffer.left(endText);
-    m_buffer = m_buffer.mid(endText + 1);           // Remove message from buffer
+void InnovationReader::setTag(const QString &id, qint64 readTime)
+{
+    setId(id, readTime);
+}
 
-    // Process data
-    int startText = data.indexOf(0x02);         // STX
-    if (startText == -1) {
-        qWarning() << "Start TEXT not found;";
-        return;
+void InnovationReader::readData()
+{
+    TRACE_SCOPE("readData");
+    // Serial bytes go straight into the parser ring, all complete frames are taken at each read
+    char frameId[FrameParser::IdLength];
+    forever {
+        int size;
+        char* data = m_parser.writePointer(&size);
+        qint64 count = size > 0 ? m_serial->read(data, size) : 0;
+        if (count <= 0) break;
+        m_parser.commit(int(count));
+        while (m_parser.next(frameId)) {
+            m_frames->add();
+            setId(QString::fromLatin1(frameId, FrameParser::IdLength), Metrics::now());
+        }
     }
-    data = data.mid(startText + 1);
-    if (data.count() < 12) {
-        qWarning() << "No enough data read from the Innovation RFID reader : " << data.count() << data;
-        return;
+
+    const FrameParser::Statistics &statistics = m_parser.statistics();
+    quint64 errors = statistics.checksumErrors + statistics.framingErrors;
+    if (errors != m_errorsReported) {
+        qWarning() << "Innovation reader " << m_serial->portName() << " errors, checksum : " << statistics.checksumErrors
+                   << " framing : " << statistics.framingErrors << " dropped bytes : " << statistics.droppedBytes
+                   << " frames : " << statistics.frames;
+        m_errors->add(errors - m_errorsReported);
+        m_errorsReported = errors;
     }
-    QByteArray id = data.left(10);
-    setId(id);
 }
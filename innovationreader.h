@@ -3,26 +3,37 @@
 
 #include <QJsonObject>
 #include "detectorinterface.h"
+#include "frameparser.h"
 
 class QSerialPort;
 class GpioInterface;
+class MetricCounter;
 
 class InnovationReader : public DetectorInterface
 {
     Q_OBJECT
 
 public:
-    InnovationReader(const QJsonObject& config, QObject *parent = 0);
+    InnovationReader(const QJsonObject& globalConfig, const QJsonObject& config, QObject *parent = 0);
+    ~InnovationReader();
 
+    const FrameParser::Statistics& statistics() const { return m_parser.statistics(); }
+
+public slots:
+    // Tags read by the RFID I/O service, with the Metrics::now() of their frame
+    void setTag(const QString &id, qint64 readTime);
 
 private slots:
     void readData();
 
 private:
     QJsonObject m_config;
-    QSerialPort* m_serial;
+    QSerialPort* m_serial = nullptr;      // Null when the port is read by the RFID I/O service
     GpioInterface* m_tagInRange;
-    QByteArray m_buffer;
+    FrameParser m_parser;
+    quint64 m_errorsReported = 0;
+    MetricCounter* m_frames;
+    MetricCounter* m_errors;
 };
 
 #endif // INNOVATIONREADER_H
@@ -0,0 +1,285 @@
+#include "localjournal.h"
+
+#include <QtSql>
+#include <QtDebug>
+
+/*
+ * Append only journal used while Postgres is unreachable, replayed in bulk on reconnect.
+ * Meals are keyed by their id so a meal updated several times offline is kept once,
+ * and replay is an upsert : replaying twice after a crash gives the same meals table.
+ * A local meal id gets its database id before the meal is written, the pair is kept here
+ * so a replay or a later update after a restart upserts the same row.
+ */
+
+LocalJournal::LocalJournal(const QString &fileName) :
+    m_fileName(fileName)
+  , m_connectionName("journal")
+{
+}
+
+LocalJournal::~LocalJournal()
+{
+    close();
+}
+
+bool LocalJournal::open()
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    db.setDatabaseName(m_fileName);
+    if (!db.open()) {
+        qWarning() << "[LocalJournal] Impossible to open journal : " << m_fileName << db.lastError().text();
+        return false;
+    }
+
+    // WAL with full synchronous mode, so a power cut never loses a committed meal
+    exec("PRAGMA journal_mode = WAL");
+    exec("PRAGMA synchronous = FULL");
+    bool ok = exec("CREATE TABLE IF NOT EXISTS meals (id INTEGER PRIMARY KEY, cow INTEGER, box INTEGER, fooda REAL, foodb REAL, entry INTEGER, exit INTEGER)")
+           && exec("CREATE TABLE IF NOT EXISTS identification (rfid TEXT PRIMARY KEY)")
+           && exec("CREATE TABLE IF NOT EXISTS logevents (seq INTEGER PRIMARY KEY AUTOINCREMENT, level TEXT, message TEXT, time INTEGER)")
+           && exec("CREATE TABLE IF NOT EXISTS mealids (localid INTEGER PRIMARY KEY, id INTEGER)");
+    updateEmpty();
+    if (!m_empty) qDebug() << "[LocalJournal] Journal contains data to replay : " << m_fileName;
+    return ok;
+}
+
+void LocalJournal::close()
+{
+    if (!QSqlDatabase::contains(m_connectionName)) return;
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool LocalJournal::append(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs)
+{
+    if (meals.isEmpty() && rfids.isEmpty() && logs.isEmpty()) return true;
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen()) return false;
+
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO meals (id, cow, box, fooda, foodb, entry, exit) VALUES (?, ?, ?, ?, ?, ?, ?)");
+    for (const MealRecord &meal : meals) {
+        query.addBindValue(meal.id);
+        query.addBindValue(meal.cow);
+        query.addBindValue(meal.box);
+        query.addBindValue(meal.foodA);
+        query.addBindValue(meal.foodB);
+        query.addBindValue(meal.entry.toMSecsSinceEpoch());
+        query.addBindValue(meal.exit.toMSecsSinceEpoch());
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] meal append error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    query.prepare("INSERT OR IGNORE INTO identification (rfid) VALUES (?)");
+    for (const QString &rfid : rfids) {
+        query.addBindValue(rfid);
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] identification append error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    query.prepare("INSERT INTO logevents (level, message, time) VALUES (?, ?, ?)");
+    for (const LogRecord &log : logs) {
+        query.addBindValue(log.level);
+        query.addBindValue(log.message);
+        query.addBindValue(log.time.toMSecsSinceEpoch());
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] log append error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        qWarning() << "[LocalJournal] commit error : " << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    m_empty = false;
+    return true;
+}
+
+QList<MealRecord> LocalJournal::meals(int limit)
+{
+    QList<MealRecord> meals;
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.setForwardOnly(true);
+    query.prepare("SELECT id, cow, box, fooda, foodb, entry, exit FROM meals ORDER BY entry LIMIT ?");
+    query.addBindValue(limit);
+    if (!query.exec()) {
+        qWarning() << "[LocalJournal] meals read error : " << query.lastError().text();
+        return meals;
+    }
+    while (query.next()) {
+        MealRecord meal;
+        meal.id = query.value(0).toLongLong();
+        meal.cow = query.value(1).toInt();
+        meal.box = query.value(2).toInt();
+        meal.foodA = query.value(3).toReal();
+        meal.foodB = query.value(4).toReal();
+        meal.entry = QDateTime::fromMSecsSinceEpoch(query.value(5).toLongLong());
+        meal.exit = QDateTime::fromMSecsSinceEpoch(query.value(6).toLongLong());
+        meals.append(meal);
+    }
+    return meals;
+}
+
+QStringList LocalJournal::identifications(int limit)
+{
+    QStringList rfids;
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.setForwardOnly(true);
+    query.prepare("SELECT rfid FROM identification LIMIT ?");
+    query.addBindValue(limit);
+    if (!query.exec()) {
+        qWarning() << "[LocalJournal] identification read error : " << query.lastError().text();
+        return rfids;
+    }
+    while (query.next()) rfids.append(query.value(0).toString());
+    return rfids;
+}
+
+QList<LogRecord> LocalJournal::logs(int limit, qint64 *lastSequence)
+{
+    QList<LogRecord> logs;
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.setForwardOnly(true);
+    query.prepare("SELECT seq, level, message, time FROM logevents ORDER BY seq LIMIT ?");
+    query.addBindValue(limit);
+    if (!query.exec()) {
+        qWarning() << "[LocalJournal] logevents read error : " << query.lastError().text();
+        return logs;
+    }
+    while (query.next()) {
+        *lastSequence = query.value(0).toLongLong();
+        LogRecord log;
+        log.level = query.value(1).toString();
+        log.message = query.value(2).toString();
+        log.time = QDateTime::fromMSecsSinceEpoch(query.value(3).toLongLong());
+        logs.append(log);
+    }
+    return logs;
+}
+
+bool LocalJournal::removeMeals(const QList<MealRecord> &meals)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare("DELETE FROM meals WHERE id = ?");
+    for (const MealRecord &meal : meals) {
+        query.addBindValue(meal.id);
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] meal remove error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    bool ok = db.commit();
+    updateEmpty();
+    return ok;
+}
+
+bool LocalJournal::removeIdentifications(const QStringList &rfids)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare("DELETE FROM identification WHERE rfid = ?");
+    for (const QString &rfid : rfids) {
+        query.addBindValue(rfid);
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] identification remove error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    bool ok = db.commit();
+    updateEmpty();
+    return ok;
+}
+
+bool LocalJournal::removeLogs(qint64 lastSequence)
+{
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.prepare("DELETE FROM logevents WHERE seq <= ?");
+    query.addBindValue(lastSequence);
+    bool ok = query.exec();
+    if (!ok) qWarning() << "[LocalJournal] logevents remove error : " << query.lastError().text();
+    updateEmpty();
+    return ok;
+}
+
+QHash<qint64, qint64> LocalJournal::mealIds()
+{
+    QHash<qint64, qint64> ids;
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT localid, id FROM mealids")) {
+        qWarning() << "[LocalJournal] meal ids read error : " << query.lastError().text();
+        return ids;
+    }
+    while (query.next()) ids.insert(query.value(0).toLongLong(), query.value(1).toLongLong());
+    return ids;
+}
+
+bool LocalJournal::addMealIds(const QHash<qint64, qint64> &ids)
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (!db.isOpen()) return false;
+    db.transaction();
+    QSqlQuery query(db);
+    query.prepare("INSERT OR REPLACE INTO mealids (localid, id) VALUES (?, ?)");
+    for (auto i = ids.constBegin(); i != ids.constEnd(); i++) {
+        query.addBindValue(i.key());
+        query.addBindValue(i.value());
+        if (!query.exec()) {
+            qWarning() << "[LocalJournal] meal id append error : " << query.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        qWarning() << "[LocalJournal] commit error : " << db.lastError().text();
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool LocalJournal::pruneMealIds(qint64 localIdLimit)
+{
+    // Local ids grow older towards zero, a meal still waiting in the journal keeps its pair
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    query.prepare("DELETE FROM mealids WHERE localid > ? AND localid NOT IN (SELECT id FROM meals)");
+    query.addBindValue(localIdLimit);
+    bool ok = query.exec();
+    if (!ok) qWarning() << "[LocalJournal] meal ids prune error : " << query.lastError().text();
+    return ok;
+}
+
+bool LocalJournal::exec(const QString &sql)
+{
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    if (!query.exec(sql)) {
+        qWarning() << "[LocalJournal] query error : " << sql << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+void LocalJournal::updateEmpty()
+{
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    m_empty = query.exec("SELECT (SELECT COUNT(*) FROM meals) + (SELECT COUNT(*) FROM identification) + (SELECT COUNT(*) FROM logevents)")
+            && query.next() && query.value(0).toLongLong() == 0;
+}
@@ -0,0 +1,66 @@
+#ifndef LOCALJOURNAL_H
+#define LOCALJOURNAL_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+
+struct MealRecord
+{
+    qint64 id = 0;                  // Reserved meals.id, or a negative local id when none was available
+    int cow = -1;
+    int box = -1;
+    qreal foodA = 0.0;
+    qreal foodB = 0.0;
+    QDateTime entry;
+    QDateTime exit;
+};
+
+struct LogRecord
+{
+    QString level;
+    QString message;
+    QDateTime time;
+};
+
+/*
+ * Local SQLite database (WAL mode) holding what could not be written to Postgres.
+ * Only used from the database writer thread.
+ */
+class LocalJournal
+{
+public:
+    explicit LocalJournal(const QString &fileName);
+    ~LocalJournal();
+
+    bool open();
+    void close();
+    bool isEmpty() const { return m_empty; }
+
+    bool append(const QList<MealRecord> &meals, const QStringList &rfids, const QList<LogRecord> &logs);
+
+    // Read the oldest rows, remove them once written to Postgres
+    QList<MealRecord> meals(int limit);
+    QStringList identifications(int limit);
+    QList<LogRecord> logs(int limit, qint64 *lastSequence);
+    bool removeMeals(const QList<MealRecord> &meals);
+    bool removeIdentifications(const QStringList &rfids);
+    bool removeLogs(qint64 lastSequence);
+
+    // Database ids given to local meal ids, kept until the meal can't be updated any more
+    QHash<qint64, qint64> mealIds();
+    bool addMealIds(const QHash<qint64, qint64> &ids);
+    bool pruneMealIds(qint64 localIdLimit);
+
+private:
+    bool exec(const QString &sql);
+    void updateEmpty();
+
+private:
+    QString m_fileName;
+    QString m_connectionName;
+    bool m_empty = true;
+};
+
+#endif // LOCALJOURNAL_H
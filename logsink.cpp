@@ -0,0 +1,271 @@
+#include "logsink.h"
+
+#include <QtSql>
+#include <QThread>
+#include <QTimer>
+#include <iostream>
+
+#include "cowdetector.h"
+#include "databasewriter.h"
+#include "sqlstatements.h"
+#include "metrics.h"
+
+/*
+ * Messages handler writing logs to the logevents table.
+ * The handler only pushes the message in a lock free ring, a background thread drains it
+ * with multi rows inserts. When the ring is full the message is dropped (and counted),
+ * it goes to console like any message emitted while handling a message.
+ * Critical and fatal messages go to console at once too, a fatal one aborts before the drain.
+ * Nothing here may use qDebug/qWarning, it would come back in the handler.
+ */
+
+std::atomic<LogSink*> LogSink::m_instance{nullptr};
+std::atomic<int> LogSink::m_handlers{0};
+
+static const int DrainInterval = 250;
+static const int BatchSize = 200;               // Rows per INSERT statement
+
+LogSink::LogSink(const QJsonObject &config, QObject *parent) :
+    QObject(parent)
+  , m_config(config)
+  , m_thread(new QThread)
+  , m_connectionName("logsink")
+  , m_head(0)
+  , m_dropped(0)
+{
+    QString level = m_config.value("logLevel").toString("debug").toLower();
+    if (level == "info") m_minimumSeverity = severity(QtInfoMsg);
+    else if (level == "warning") m_minimumSeverity = severity(QtWarningMsg);
+    else if (level == "critical") m_minimumSeverity = severity(QtCriticalMsg);
+
+    // Power of two, so a position is mapped to its slot with a mask
+    quint64 capacity = 1;
+    while (capacity < quint64(qMax(2, m_config.value("logBufferSize").toInt(4096)))) capacity <<= 1;
+    m_mask = capacity - 1;
+    m_slots = new Slot[capacity];
+    for (quint64 i = 0; i < capacity; i++) m_slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    m_thread->setObjectName("LogSink");
+    moveToThread(m_thread);
+}
+
+LogSink::~LogSink()
+{
+    delete[] m_slots;
+    delete m_thread;
+}
+
+void LogSink::install(const QJsonObject &config)
+{
+    if (m_instance.load()) return;
+    LogSink* sink = new LogSink(config);
+    sink->m_thread->start();
+    QMetaObject::invokeMethod(sink, "open", Qt::QueuedConnection);
+    m_instance.store(sink);
+    qInstallMessageHandler(messageHandler);
+}
+
+void LogSink::uninstall()
+{
+    if (!m_instance.load()) return;
+    qInstallMessageHandler(0);
+
+    // Handlers of other threads may still push, wait for them before the last drain
+    LogSink* sink = m_instance.exchange(nullptr);
+    while (m_handlers.load() > 0) QThread::yieldCurrentThread();
+
+    // Last messages are written before leaving
+    QMetaObject::invokeMethod(sink, "drain", Qt::BlockingQueuedConnection);
+    QMetaObject::invokeMethod(sink, "close", Qt::BlockingQueuedConnection);
+    sink->m_thread->quit();
+    sink->m_thread->wait();
+    delete sink;
+}
+
+void LogSink::messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    Q_UNUSED(context);
+    static thread_local bool handling = false;
+
+    if (handling) {
+        console(msg);
+        return;
+    }
+
+    // Counted before the sink is read, uninstall waits for it
+    m_handlers.fetch_add(1);
+    LogSink* sink = m_instance.load();
+    if (!sink) {
+        m_handlers.fetch_sub(1);
+        console(msg);
+        return;
+    }
+
+    handling = true;
+    bool urgent = severity(type) >= severity(QtCriticalMsg);
+    if (urgent) console(msg);
+    if (severity(type) >= sink->m_minimumSeverity && !sink->push(type, msg)) {
+        sink->m_dropped.fetch_add(1, std::memory_order_relaxed);
+        if (!urgent) console(msg);
+    }
+    handling = false;
+    m_handlers.fetch_sub(1);
+}
+
+int LogSink::severity(QtMsgType type)
+{
+    switch (type) {
+    case QtDebugMsg:    return 0;
+    case QtInfoMsg:     return 1;
+    case QtWarningMsg:  return 2;
+    case QtCriticalMsg: return 3;
+    case QtFatalMsg:    return 4;
+    }
+    return 0;
+}
+
+void LogSink::console(const QString &msg)
+{
+    std::cout << msg.toLatin1().data() << std::endl;
+}
+
+bool LogSink::push(QtMsgType type, const QString &message)
+{
+    // Claim a slot : its sequence equals the position when it is free for this turn
+    quint64 position = m_head.load(std::memory_order_relaxed);
+    Slot* slot;
+    forever {
+        slot = &m_slots[position & m_mask];
+        qint64 diff = qint64(slot->sequence.load(std::memory_order_acquire)) - qint64(position);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+        }
+        else if (diff < 0) return false;    // Full, the drain thread is late
+        else position = m_head.load(std::memory_order_relaxed);
+    }
+
+    if (type == QtDebugMsg) slot->record.level = QStringLiteral("DEBUG");
+    else if (type == QtWarningMsg) slot->record.level = QStringLiteral("WARNING");
+    else slot->record.level = QStringLiteral("OTHER");
+    slot->record.message = message;
+    slot->record.time = QDateTime::currentDateTime();
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool LogSink::pop(LogRecord *record)
+{
+    Slot &slot = m_slots[m_tail & m_mask];
+    if (slot.sequence.load(std::memory_order_acquire) != m_tail + 1) return false;
+
+    *record = slot.record;
+    slot.record = LogRecord();
+    slot.sequence.store(m_tail + m_mask + 1, std::memory_order_release);
+    m_tail++;
+    return true;
+}
+
+void LogSink::open()
+{
+    m_drainTimer = new QTimer(this);
+    m_drainTimer->setInterval(DrainInterval);
+    m_drainTimer->setSingleShot(false);
+    connect(m_drainTimer, &QTimer::timeout, this, &LogSink::drain);
+    m_drainTimer->start();
+
+    CowDetector::addDatabase(m_config, m_connectionName);
+    reconnect();
+}
+
+void LogSink::drain()
+{
+    forever {
+        QList<LogRecord> logs;
+        LogRecord record;
+        while (logs.count() < BatchSize && pop(&record)) logs.append(record);
+
+        quint64 dropped = m_dropped.load(std::memory_order_relaxed);
+        if (dropped != m_droppedReported) {
+            LogRecord report;
+            report.level = QStringLiteral("WARNING");
+            report.message = QString("[LogSink] %1 messages dropped, log buffer full.").arg(dropped - m_droppedReported);
+            report.time = QDateTime::currentDateTime();
+            logs.append(report);
+            m_droppedReported = dropped;
+        }
+        if (logs.isEmpty()) return;
+
+        if (!write(logs)) {
+            // Kept in the local journal until the database is back
+            DatabaseWriter* writer = CowDetector::instance() ? CowDetector::instance()->writer() : nullptr;
+            for (const LogRecord &log : logs) {
+                console(log.message);
+                if (writer) writer->logEvent(log.level, log.message);
+            }
+        }
+        if (logs.count() < BatchSize) return;
+    }
+}
+
+void LogSink::close()
+{
+    delete m_drainTimer;
+    m_drainTimer = nullptr;
+    SqlStatements::release(m_connectionName);
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool LogSink::reconnect()
+{
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    if (db.isOpen()) return true;
+    if (m_reconnectTimer.isValid() && m_reconnectTimer.elapsed() < 20000) return false;
+    m_reconnectTimer.start();
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"logsink\"");
+    reconnects->add();
+
+    if (!db.open()) {
+        std::cerr << "[LogSink] Database connection error : " << db.lastError().text().toLatin1().data() << std::endl;
+        return false;
+    }
+    SqlStatements::opened(db);
+    return true;
+}
+
+bool LogSink::write(const QList<LogRecord> &logs)
+{
+    if (!reconnect()) return false;
+
+    // Several statements of fixed row counts, in one transaction so a failure writes nothing
+    QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+    db.transaction();
+    for (int first = 0, count; first < logs.count(); first += count) {
+        count = SqlStatements::batchSize(logs.count() - first, BatchSize);
+        QString sql = "INSERT INTO logevents (level, message) VALUES ";
+        for (int i = 0; i < count; i++) sql += i == 0 ? "(?, ?)" : ", (?, ?)";
+
+        QSqlQuery* query = SqlStatements::prepared(db, sql);
+        int position = 0;
+        for (int i = first; i < first + count; i++) {
+            query->bindValue(position++, logs.at(i).level);
+            query->bindValue(position++, logs.at(i).message);
+        }
+        if (!SqlStatements::exec(query)) {
+            std::cerr << "[LogSink] Log error : " << query->lastError().text().toLatin1().data() << std::endl;
+            db.rollback();
+            db.close();             // Reopened at next drain
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        std::cerr << "[LogSink] Log commit error : " << db.lastError().text().toLatin1().data() << std::endl;
+        db.rollback();
+        db.close();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <atomic>
+
+#include "localjournal.h"
+
+class QThread;
+class QTimer;
+
+class LogSink : public QObject
+{
+    Q_OBJECT
+public:
+    static void install(const QJsonObject &config);
+    static void uninstall();
+    static LogSink* instance() { return m_instance.load(); }
+
+    quint64 dropped() const { return m_dropped.load(); }
+
+private:
+    explicit LogSink(const QJsonObject &config, QObject *parent = 0);
+    ~LogSink();
+
+    static void messageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+    static int severity(QtMsgType type);
+    static void console(const QString &msg);
+
+    bool push(QtMsgType type, const QString &message);
+    bool pop(LogRecord *record);
+
+private slots:
+    void open();
+    void drain();
+    void close();
+
+private:
+    bool reconnect();
+    bool write(const QList<LogRecord> &logs);
+
+private:
+    // Bounded multi producer, single consumer ring : producers never take a lock
+    struct Slot {
+        std::atomic<quint64> sequence;
+        LogRecord record;
+    };
+
+    static std::atomic<LogSink*> m_instance;
+    static std::atomic<int> m_handlers;     // Handlers running, the sink is deleted once none uses it
+    QJsonObject m_config;
+    QThread* m_thread;
+    QTimer* m_drainTimer = nullptr;
+    QString m_connectionName;
+    QElapsedTimer m_reconnectTimer;
+    int m_minimumSeverity = 0;
+
+    Slot* m_slots;
+    quint64 m_mask;
+    std::atomic<quint64> m_head;
+    quint64 m_tail = 0;                     // Drain thread only
+    std::atomic<quint64> m_dropped;
+    quint64 m_droppedReported = 0;
+};
+
+#endif // LOGSINK_H
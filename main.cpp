@@ -1,16 +1,20 @@
 #include <QCoreApplication>
 
-#include <iostream>
 #include <QDebug>
 #include <QTimer>
-#include <QFile>
-#include <QJsonParseError>
-#include <QJsonArray>
 #include <QtSql>
 
 #include "gpiointerface.h"
 #include "cowbox.h"
+#include "boxmanager.h"
 #include "cowdetector.h"
+#include "logsink.h"
+#include "sqlstatements.h"
+#include "hardwarefactory.h"
+#include "tracer.h"
+#include "configwatcher.h"
+#include "startupphases.h"
+#include "clock.h"
 
 #ifdef Q_OS_WIN
 #include <QGuiApplication>
@@ -21,8 +25,6 @@
 #include "rpigpio.h"
 #endif
 
-void cowLogMsgHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
-
 void interruptHandler(int sig)
 {
     Q_UNUSED(sig);
@@ -41,85 +43,71 @@ int main(int argc, char *argv[])
 #else
     QCoreApplication app(argc, argv);
 #endif
+    StartupPhases::begin();
+    Clock::instance();          // Created in the main thread, before the box threads
     qDebug() << "[CowDetector] Application starting...";
 
     // Read on JSON file
-    QList<QObject*> cowboxes;
-    QFile tagsFile("cowdetector.json");
-    if (!tagsFile.open(QIODevice::ReadOnly)) {
-        qWarning() << "Error opening cowdetector tags file : " << tagsFile.fileName();
-        return -1;
-    }
-    QByteArray json = tagsFile.readAll();
-    QJsonParseError error;
-    QJsonDocument tags = QJsonDocument::fromJson(json, &error);
-    if (tags.isNull() || !tags.isObject()) {
-        qWarning() << "Error parsing Maestro tags file: " << tagsFile.fileName() << " - " << error.errorString();
+    QString error;
+    QJsonObject jsonObject = ConfigWatcher::read("cowdetector.json", &error);
+    if (jsonObject.isEmpty()) {
+        qWarning() << "Error reading cowdetector file : cowdetector.json - " << error;
         return -1;
     }
-    QJsonObject jsonObject = tags.object();
+    if (!HardwareFactory::isValidBackend(jsonObject)) return -1;
+    StartupPhases::mark("config");
 
     // Initialize GPIO
 #ifdef Q_OS_WIN
 #else
-    RpiGpio::initialize();
+    if (!HardwareFactory::isSimulated(jsonObject)) RpiGpio::initialize();
 #endif
+    StartupPhases::mark("gpio");
 
-    // Connect to database
+    // Shared caches from the startup snapshot, the database is connected in the background
     CowDetector::firstInstance(jsonObject);
+    StartupPhases::mark("core");
 
     // Install debug handler to write logs to database
-    qInstallMessageHandler(cowLogMsgHandler);
+    LogSink::install(jsonObject);
+    Tracer::install(jsonObject);
+    StartupPhases::mark("logs");
 
-    // Create cow boxes on demand
-    auto boxArray = jsonObject.value("boxes").toArray();
-    for (QJsonArray::const_iterator i = boxArray.constBegin(); i != boxArray.constEnd(); i++) {
-        CowBox* box = new CowBox((*i).toObject(), nullptr);
-        cowboxes.append(box);
-    }
+    // Create cow boxes on demand, in the main thread or in worker threads
+    BoxManager* boxManager = new BoxManager(jsonObject);
+    StartupPhases::mark("boxes");
+
+    // Apply changes of the file to the boxes, others need a restart
+    ConfigWatcher* configWatcher = new ConfigWatcher("cowdetector.json");
+    QObject::connect(configWatcher, &ConfigWatcher::configChanged, boxManager, &BoxManager::reconfigure);
 
 #ifdef Q_OS_WIN
     QQmlApplicationEngine engine(QUrl("qrc:/qml/main.qml"));
     engine.rootContext()->setContextProperty("runningGpio", CowDetector::instance()->runningGpio());
-    engine.rootContext()->setContextProperty("box", cowboxes.first());
+    engine.rootContext()->setContextProperty("box", boxManager->boxes().first());
 #endif
 
-    qDebug() << "[CowDetector] Started.";
+    qDebug() << "[CowDetector] Started, ready to dispense after " << StartupPhases::elapsed() << "ms.";
     app.exec();
     qDebug() << "[CowDetector] Stopped.";
 
-    // Close database
-    QSqlDatabase::database().close();
+    // Delete objects before end of program, boxes first as they may still run in their threads
+    delete configWatcher;
+    delete boxManager;
+    HardwareFactory::cleanUp();
+    Tracer::uninstall();
+    LogSink::uninstall();
 
-    // Delete objects before end of program
+    // Close database
+    SqlStatements::report();
+    SqlStatements::release(QSqlDatabase::defaultConnection);
+    QSqlDatabase::database(QSqlDatabase::defaultConnection, false).close();
     CowDetector::deleteCowDetector();
-    for (auto box : cowboxes) delete box;
 
 #ifdef Q_OS_WIN
 #else
-    RpiGpio::cleanUp();
+    if (!HardwareFactory::isSimulated(jsonObject)) RpiGpio::cleanUp();
 #endif
 
     return 0;
 }
-
-void cowLogMsgHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
-{
-    Q_UNUSED(context);
-    QSqlDatabase db = QSqlDatabase::database();
-    if (!db.isOpen()) {
-        std::cout << msg.toLatin1().data();
-        return;
-    }
-
-    QSqlQuery query(db);
-    query.prepare("INSERT INTO logevents (level, message) VALUES (:level, :message)");
-    if (type == QtDebugMsg) query.bindValue(":level", "DEBUG");
-    else if (type == QtWarningMsg) query.bindValue(":level", "WARNING");
-    else query.bindValue(":level", "OTHER");
-    query.bindValue(":message", msg);
-    if (!query.exec()) {
-        std::cerr << "[cowLogMsgHandler] Log error : " << query.lastError().text().toLatin1().data();
-        std::cerr << query.lastQuery().toLatin1().data();
-    }
-}
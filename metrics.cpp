@@ -0,0 +1,146 @@
+#include "metrics.h"
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QMap>
+#include <QMutex>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QtDebug>
+
+/*
+ * Hot paths only do relaxed atomic increments on metrics they looked up once.
+ * The registry lock is taken when a metric is created and when the endpoint is scraped.
+ * Histograms are exposed in seconds, the bucket bounds are powers of two microseconds.
+ */
+
+struct MetricFamily {
+    QString help;
+    bool histogram;
+    QMap<QString, void*> metrics;           // By labels, never deleted
+};
+
+static QMutex registryMutex;
+static QMap<QString, MetricFamily> families;
+
+static void* find(const QString &name, const QString &help, const QString &labels, bool histogram)
+{
+    QMutexLocker locker(&registryMutex);
+    MetricFamily &family = families[name];
+    if (family.metrics.isEmpty()) {
+        family.help = help;
+        family.histogram = histogram;
+    }
+    else if (family.histogram != histogram) {
+        qWarning() << "[Metrics] " << name << " used as counter and histogram";
+        return nullptr;
+    }
+
+    void* metric = family.metrics.value(labels);
+    if (!metric) {
+        if (histogram) metric = new MetricHistogram;
+        else metric = new MetricCounter;
+        family.metrics.insert(labels, metric);
+    }
+    return metric;
+}
+
+void MetricHistogram::observe(qint64 us)
+{
+    // Smallest bucket with us <= 2^index
+    int index = us <= 1 ? 0 : 64 - qCountLeadingZeroBits(quint64(us - 1));
+    m_buckets[qMin(index, Buckets - 1)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(quint64(qMax(qint64(0), us)), std::memory_order_relaxed);
+}
+
+MetricHistogram* Metrics::histogram(const QString &name, const QString &help, const QString &labels)
+{
+    static MetricHistogram unused;          // Name clash, observed but not exposed
+    MetricHistogram* metric = static_cast<MetricHistogram*>(find(name, help, labels, true));
+    return metric ? metric : &unused;
+}
+
+MetricCounter* Metrics::counter(const QString &name, const QString &help, const QString &labels)
+{
+    static MetricCounter unused;
+    MetricCounter* metric = static_cast<MetricCounter*>(find(name, help, labels, false));
+    return metric ? metric : &unused;
+}
+
+qint64 Metrics::now()
+{
+    static const QElapsedTimer reference = []() { QElapsedTimer timer; timer.start(); return timer; }();
+    return reference.nsecsElapsed() / 1000;
+}
+
+static QString withLabels(const QString &labels, const QString &extra = QString())
+{
+    if (labels.isEmpty() && extra.isEmpty()) return QString();
+    if (labels.isEmpty() || extra.isEmpty()) return "{" + labels + extra + "}";
+    return "{" + labels + "," + extra + "}";
+}
+
+QByteArray Metrics::exposition()
+{
+    QString text;
+    QMutexLocker locker(&registryMutex);
+    for (auto family = families.constBegin(); family != families.constEnd(); family++) {
+        const QString &name = family.key();
+        text += QString("# HELP %1 %2\n# TYPE %1 %3\n").arg(name, family->help, family->histogram ? "histogram" : "counter");
+
+        for (auto i = family->metrics.constBegin(); i != family->metrics.constEnd(); i++) {
+            if (!family->histogram) {
+                text += name + withLabels(i.key()) + " " + QString::number(static_cast<MetricCounter*>(i.value())->value()) + "\n";
+                continue;
+            }
+
+            const MetricHistogram* histogram = static_cast<const MetricHistogram*>(i.value());
+            quint64 cumulative = 0;
+            for (int bucket = 0; bucket < MetricHistogram::Buckets; bucket++) {
+                cumulative += histogram->m_buckets[bucket].load(std::memory_order_relaxed);
+                QString bound = bucket == MetricHistogram::Buckets - 1 ? QString("+Inf") : QString::number((1ll << bucket) / 1e6, 'g', 10);
+                text += name + "_bucket" + withLabels(i.key(), "le=\"" + bound + "\"") + " " + QString::number(cumulative) + "\n";
+            }
+            text += name + "_sum" + withLabels(i.key()) + " " + QString::number(histogram->m_sum.load(std::memory_order_relaxed) / 1e6, 'g', 15) + "\n";
+            text += name + "_count" + withLabels(i.key()) + " " + QString::number(cumulative) + "\n";
+        }
+    }
+    return text.toUtf8();
+}
+
+MetricsServer::MetricsServer(const QString &address, int port, QObject *parent) :
+    QObject(parent)
+  , m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection, this, &MetricsServer::newConnection);
+    if (!m_server->listen(QHostAddress(address), quint16(port))) {
+        qWarning() << "[MetricsServer] Listen error on " << address << port << " : " << m_server->errorString();
+        return;
+    }
+    qDebug() << "[MetricsServer] Metrics on http://" << address << ":" << port << "/metrics";
+}
+
+void MetricsServer::newConnection()
+{
+    while (QTcpSocket* socket = m_server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, socket, [socket]() {
+            // Only the request line matters, headers are not read
+            if (!socket->canReadLine()) {
+                if (socket->bytesAvailable() > 4096) socket->abort();
+                return;
+            }
+            QList<QByteArray> request = socket->readLine().simplified().split(' ');
+            QByteArray body;
+            QByteArray status = "404 Not Found";
+            if (request.value(0) == "GET" && (request.value(1) == "/metrics" || request.value(1) == "/")) {
+                status = "200 OK";
+                body = Metrics::exposition();
+            }
+            socket->write("HTTP/1.0 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                          + QByteArray::number(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+            QObject::disconnect(socket, &QTcpSocket::readyRead, nullptr, nullptr);
+            socket->disconnectFromHost();
+        });
+    }
+}
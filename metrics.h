@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QObject>
+#include <QString>
+#include <atomic>
+
+class QTcpServer;
+
+// Latency distribution in power of two buckets of microseconds, observed without lock
+class MetricHistogram
+{
+public:
+    static const int Buckets = 27;          // Up to 2^25 us (33 s), then overflow
+
+    void observe(qint64 us);
+
+private:
+    friend class Metrics;
+    std::atomic<quint64> m_buckets[Buckets] = {};
+    std::atomic<quint64> m_sum{0};          // Microseconds
+};
+
+class MetricCounter
+{
+public:
+    void add(quint64 value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+// Process wide metrics, created once by name and labels (like box="4") and kept by their users
+class Metrics
+{
+public:
+    static MetricHistogram* histogram(const QString &name, const QString &help, const QString &labels = QString());
+    static MetricCounter* counter(const QString &name, const QString &help, const QString &labels = QString());
+
+    // Monotonic time for latencies, microseconds
+    static qint64 now();
+
+    // Prometheus text format
+    static QByteArray exposition();
+
+private:
+    Metrics() {}
+};
+
+// GET /metrics on a local port, answered from the thread creating it
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsServer(const QString &address, int port, QObject *parent = 0);
+
+private slots:
+    void newConnection();
+
+private:
+    QTcpServer* m_server;
+};
+
+#endif // METRICS_H
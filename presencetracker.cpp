@@ -0,0 +1,116 @@
+#include "presencetracker.h"
+
+#include "detectorinterface.h"
+#include "clock.h"
+#include "metrics.h"
+
+/*
+ * A cow moving her head at the edge of the antenna makes the tag in range flap, and the reader
+ * sends the tag again at each return. The tracker holds the cow present while the tag comes back
+ * within the leave delay, and asks several reads of a new tag before taking it.
+ */
+
+PresenceTracker::PresenceTracker(DetectorInterface *detector, const QJsonObject &config, const QString &labels, QObject *parent) :
+    QObject(parent)
+  , m_enterReads(qMax(1, config.value("enterReads").toInt(1)))
+  , m_readWindow(config.value("readWindow").toInt(2000))
+  , m_leaveDelay(config.value("leaveDelay").toInt(0))
+  , m_minimumDwell(config.value("minimumDwell").toInt(0))
+  , m_leaveTimer(new ClockTimer(this))
+  , m_readCounter(Metrics::counter("cowdetector_presence_reads_total", "Tag reads given to the presence tracker", labels))
+  , m_entryCounter(Metrics::counter("cowdetector_presence_entries_total", "Cow entries taken by the presence tracker", labels))
+  , m_exitCounter(Metrics::counter("cowdetector_presence_exits_total", "Cow exits given by the presence tracker", labels))
+  , m_flapCounter(Metrics::counter("cowdetector_presence_flaps_total", "Tags lost then read again before the leave delay", labels))
+  , m_rejectedCounter(Metrics::counter("cowdetector_presence_rejected_total", "Tags not read enough to count as an entry", labels))
+{
+    m_leaveTimer->setSingleShot(true);
+    connect(m_leaveTimer, &ClockTimer::timeout, this, &PresenceTracker::leave);
+    connect(detector, &DetectorInterface::tagRead, this, &PresenceTracker::tagRead);
+    connect(detector, &DetectorInterface::idChanged, this, &PresenceTracker::detectorIdChanged);
+}
+
+bool PresenceTracker::isValidConfig(const QJsonObject &global, const QJsonObject &config, QString *error)
+{
+    if (!global.value("rfidIoService").toBool(false)) return true;
+    int enterReads = qMax(1, config.value("enterReads").toInt(1));
+    int readWindow = config.value("readWindow").toInt(2000);
+    int repeatInterval = global.value("rfidRepeatInterval").toInt(1000);
+    // The first read opens the window, the others come one repeat interval apart
+    if (enterReads == 1 || (enterReads - 1) * repeatInterval <= readWindow) return true;
+    if (error) *error = QString("(enterReads %1 - 1) * rfidRepeatInterval %2 ms is longer than readWindow %3 ms, no cow would enter")
+            .arg(enterReads).arg(repeatInterval).arg(readWindow);
+    return false;
+}
+
+void PresenceTracker::tagRead(const QString &id)
+{
+    count(m_statistics.reads, m_readCounter);
+    qint64 now = Clock::instance()->now().toMSecsSinceEpoch();
+
+    if (id == m_present) {
+        if (m_leaveTimer->isActive()) {
+            m_leaveTimer->stop();
+            count(m_statistics.flaps, m_flapCounter);
+        }
+        return;
+    }
+
+    if (id != m_candidate) {
+        dropCandidate();
+        m_candidate = id;
+    }
+    m_reads.append(now);
+    while (!m_reads.isEmpty() && m_reads.first() < now - m_readWindow) m_reads.removeFirst();
+    if (m_reads.count() >= m_enterReads) enter(id, now);
+}
+
+void PresenceTracker::detectorIdChanged(const QString &id)
+{
+    // New tags come through tagRead
+    if (!id.isEmpty()) return;
+
+    if (m_present.isEmpty()) {
+        dropCandidate();
+        return;
+    }
+
+    qint64 dwell = Clock::instance()->now().toMSecsSinceEpoch() - m_entered;
+    qint64 delay = qMax(qint64(m_leaveDelay), m_minimumDwell - dwell);
+    if (delay <= 0) leave();
+    else m_leaveTimer->start(int(delay));
+}
+
+void PresenceTracker::leave()
+{
+    m_leaveTimer->stop();
+    if (m_present.isEmpty()) return;
+    m_present.clear();
+    count(m_statistics.exits, m_exitCounter);
+    emit presentChanged(QString());
+}
+
+void PresenceTracker::enter(const QString &id, qint64 now)
+{
+    // Another tag taken while a cow is present is her exit too
+    if (!m_present.isEmpty()) count(m_statistics.exits, m_exitCounter);
+    m_leaveTimer->stop();
+    m_present = id;
+    m_entered = now;
+    m_candidate.clear();
+    m_reads.clear();
+    count(m_statistics.entries, m_entryCounter);
+    emit presentChanged(id);
+}
+
+void PresenceTracker::dropCandidate()
+{
+    if (!m_candidate.isEmpty()) count(m_statistics.rejected, m_rejectedCounter);
+    m_candidate.clear();
+    m_reads.clear();
+}
+
+void PresenceTracker::count(quint64 &statistic, MetricCounter *counter)
+{
+    statistic++;
+    counter->add();
+}
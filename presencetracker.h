@@ -0,0 +1,70 @@
+#ifndef PRESENCETRACKER_H
+#define PRESENCETRACKER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QVector>
+
+class ClockTimer;
+class DetectorInterface;
+class MetricCounter;
+
+struct PresenceStatistics {
+    quint64 reads = 0;
+    quint64 entries = 0;
+    quint64 exits = 0;
+    quint64 flaps = 0;                      // Tag lost then read again before the leave delay
+    quint64 rejected = 0;                   // Tags not read enough to count as an entry
+};
+
+// Turns the detector tag reads and losses into clean cow entries and exits.
+// Configured by the box "presence" object, the defaults forward the detector as it is :
+//   "enterReads" (1) reads of the same tag within "readWindow" ms (2000) to enter,
+//   "leaveDelay" ms (0) without the tag to leave, never before "minimumDwell" ms (0) in the box.
+// Statistics are exported as metrics with the given labels (like box="4").
+class PresenceTracker : public QObject
+{
+    Q_OBJECT
+public:
+    explicit PresenceTracker(DetectorInterface *detector, const QJsonObject &config, const QString &labels, QObject *parent = 0);
+
+    // The rfid io service gives a tag once per "rfidRepeatInterval", the entry reads must fit in the window
+    static bool isValidConfig(const QJsonObject &global, const QJsonObject &config, QString *error);
+
+    QString id() const { return m_present; }
+    const PresenceStatistics& statistics() const { return m_statistics; }
+
+signals:
+    // Tag of the cow in the box, empty once she left
+    void presentChanged(const QString &id);
+
+private slots:
+    void tagRead(const QString &id);
+    void detectorIdChanged(const QString &id);
+    void leave();
+
+private:
+    void enter(const QString &id, qint64 now);
+    void dropCandidate();
+    void count(quint64 &statistic, MetricCounter *counter);
+
+private:
+    int m_enterReads;
+    int m_readWindow;
+    int m_leaveDelay;
+    int m_minimumDwell;
+
+    QString m_present;
+    qint64 m_entered = 0;                   // ms since epoch
+    QString m_candidate;                    // Tag read but not entered yet
+    QVector<qint64> m_reads;                // Its reads in the window
+    ClockTimer* m_leaveTimer;
+    PresenceStatistics m_statistics;
+    MetricCounter* m_readCounter;
+    MetricCounter* m_entryCounter;
+    MetricCounter* m_exitCounter;
+    MetricCounter* m_flapCounter;
+    MetricCounter* m_rejectedCounter;
+};
+
+#endif // PRESENCETRACKER_H
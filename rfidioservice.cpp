@@ -0,0 +1,215 @@
+#include "rfidioservice.h"
+
+#include <QThread>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QtDebug>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/epoll.h>
+
+#include "metrics.h"
+#include "tracer.h"
+
+/*
+ * All reader ports are registered in one epoll set, its descriptor is the only one watched by
+ * the service thread. Frames are parsed there, boxes get a queued call for a new tag or for the
+ * same tag once per repeat interval, not for each frame the reader repeats while the tag is in range.
+ * Ports may be pseudo-terminals : tools/rfidpty opens some and writes frames like readers do.
+ * A port that can't be opened or hangs up is retried every few seconds.
+ */
+
+static const int ReopenInterval = 5000;
+static const int MaximumEvents = 32;
+
+RfidIoService::RfidIoService(int repeatInterval, QObject *parent) :
+    QObject(parent)
+  , m_thread(new QThread)
+  , m_repeatInterval(repeatInterval)
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        qWarning() << "[RfidIoService] epoll error : " << strerror(errno);
+        return;
+    }
+
+    m_thread->setObjectName("RfidIoService");
+    moveToThread(m_thread);
+    m_thread->start();
+    QMetaObject::invokeMethod(this, "open", Qt::BlockingQueuedConnection);
+}
+
+RfidIoService::~RfidIoService()
+{
+    if (m_thread->isRunning()) {
+        QMetaObject::invokeMethod(this, "close", Qt::BlockingQueuedConnection);
+        m_thread->quit();
+        m_thread->wait();
+    }
+    for (Reader* reader : m_readers) {
+        closePort(reader);
+        delete reader;
+    }
+    if (m_epollFd >= 0) ::close(m_epollFd);
+    delete m_thread;
+}
+
+void RfidIoService::addReader(const QString &port, QObject *receiver, bool checksum)
+{
+    QMutexLocker locker(&m_mutex);
+    Reader* reader = new Reader(checksum);
+    reader->id = m_nextId++;
+    reader->port = port;
+    reader->receiver = receiver;
+    reader->frames = Metrics::counter("cowdetector_rfid_frames_total", "Valid frames read from RFID readers", QString("port=\"%1\"").arg(port));
+    reader->errors = Metrics::counter("cowdetector_rfid_errors_total", "Checksum and framing errors of RFID readers", QString("port=\"%1\"").arg(port));
+    m_readers.insert(reader->id, reader);
+    openPort(reader);
+}
+
+void RfidIoService::removeReader(QObject *receiver)
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto i = m_readers.begin(); i != m_readers.end(); ) {
+        Reader* reader = i.value();
+        if (reader->receiver == receiver) {
+            closePort(reader);
+            delete reader;
+            i = m_readers.erase(i);
+        }
+        else i++;
+    }
+}
+
+void RfidIoService::open()
+{
+    m_notifier = new QSocketNotifier(m_epollFd, QSocketNotifier::Read, this);
+    connect(m_notifier, &QSocketNotifier::activated, this, &RfidIoService::ready);
+
+    m_reopenTimer = new QTimer(this);
+    m_reopenTimer->setInterval(ReopenInterval);
+    connect(m_reopenTimer, &QTimer::timeout, this, &RfidIoService::reopen);
+    m_reopenTimer->start();
+}
+
+void RfidIoService::close()
+{
+    delete m_notifier;
+    m_notifier = nullptr;
+    delete m_reopenTimer;
+    m_reopenTimer = nullptr;
+}
+
+void RfidIoService::ready()
+{
+    struct epoll_event events[MaximumEvents];
+    int count = epoll_wait(m_epollFd, events, MaximumEvents, 0);
+    if (count < 0 && errno != EINTR) qWarning() << "[RfidIoService] epoll wait error : " << strerror(errno);
+
+    QMutexLocker locker(&m_mutex);
+    for (int i = 0; i < count; i++) {
+        Reader* reader = m_readers.value(int(events[i].data.u32));
+        if (!reader || reader->fd < 0) continue;
+        if (events[i].events & EPOLLIN) readPort(reader);
+        if (reader->fd >= 0 && events[i].events & (EPOLLHUP | EPOLLERR) && !(events[i].events & EPOLLIN)) {
+            qWarning() << "[RfidIoService] Port hang up : " << reader->port;
+            closePort(reader);
+        }
+    }
+}
+
+void RfidIoService::reopen()
+{
+    QMutexLocker locker(&m_mutex);
+    for (Reader* reader : m_readers) {
+        if (reader->fd < 0) openPort(reader);
+    }
+}
+
+bool RfidIoService::openPort(Reader *reader)
+{
+    static MetricCounter* reconnects = Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"rfidport\"");
+    reconnects->add();
+    int fd = ::open(reader->port.toLocal8Bit().constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (!reader->openFailed) qWarning() << "[RfidIoService] Impossible to open serial port : " << reader->port << strerror(errno);
+        reader->openFailed = true;
+        return false;
+    }
+
+    // Innovation readers talk 9600 bauds, 8 bits, no parity, one stop bit
+    struct termios settings;
+    if (tcgetattr(fd, &settings) == 0) {
+        cfmakeraw(&settings);
+        cfsetispeed(&settings, B9600);
+        cfsetospeed(&settings, B9600);
+        settings.c_cflag |= CLOCAL | CREAD;
+        settings.c_cflag &= ~(CSTOPB | PARENB);
+        tcsetattr(fd, TCSANOW, &settings);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = quint32(reader->id);
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        qWarning() << "[RfidIoService] epoll add error : " << reader->port << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    reader->fd = fd;
+    reader->openFailed = false;
+    qDebug() << "[RfidIoService] Reader connected on port : " << reader->port;
+    return true;
+}
+
+void RfidIoService::closePort(Reader *reader)
+{
+    if (reader->fd < 0) return;
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, reader->fd, nullptr);
+    ::close(reader->fd);
+    reader->fd = -1;
+}
+
+void RfidIoService::readPort(Reader *reader)
+{
+    TRACE_SCOPE("readPort");
+    char frameId[FrameParser::IdLength];
+    forever {
+        int size;
+        char* data = reader->parser.writePointer(&size);
+        ssize_t count = size > 0 ? ::read(reader->fd, data, size_t(size)) : 0;
+        if (count < 0 && errno != EAGAIN && errno != EINTR) {
+            qWarning() << "[RfidIoService] Read error : " << reader->port << strerror(errno);
+            closePort(reader);
+        }
+        if (count <= 0) break;
+        reader->parser.commit(int(count));
+
+        while (reader->parser.next(frameId)) {
+            // Stamped here, the box thread may take the queued tag much later
+            qint64 readTime = Metrics::now();
+            reader->frames->add();
+            QString tag = QString::fromLatin1(frameId, FrameParser::IdLength);
+            if (tag == reader->lastTag && reader->lastDelivery.isValid() && reader->lastDelivery.elapsed() < m_repeatInterval) continue;
+            reader->lastTag = tag;
+            reader->lastDelivery.start();
+            if (reader->receiver) QMetaObject::invokeMethod(reader->receiver, "setTag", Qt::QueuedConnection, Q_ARG(QString, tag), Q_ARG(qint64, readTime));
+        }
+    }
+
+    const FrameParser::Statistics &statistics = reader->parser.statistics();
+    quint64 errors = statistics.checksumErrors + statistics.framingErrors;
+    if (errors != reader->errorsReported) {
+        qWarning() << "[RfidIoService] " << reader->port << " errors, checksum : " << statistics.checksumErrors
+                   << " framing : " << statistics.framingErrors << " dropped bytes : " << statistics.droppedBytes
+                   << " frames : " << statistics.frames;
+        reader->errors->add(errors - reader->errorsReported);
+        reader->errorsReported = errors;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef RFIDIOSERVICE_H
+#define RFIDIOSERVICE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+#include "frameparser.h"
+
+class QThread;
+class QSocketNotifier;
+class QTimer;
+class MetricCounter;
+
+// Reads every RFID reader port from one thread multiplexed with epoll, boxes only get tag events
+class RfidIoService : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RfidIoService(int repeatInterval, QObject *parent = 0);
+    ~RfidIoService();
+
+    bool isValid() const { return m_epollFd >= 0; }
+
+    // Thread safe. Tags read on the port are given to the receiver slot setTag(QString, qint64) with their read time,
+    // a tag read again is given once per repeat interval only.
+    void addReader(const QString &port, QObject *receiver, bool checksum);
+    void removeReader(QObject *receiver);
+
+private slots:
+    void open();
+    void close();
+    void ready();
+    void reopen();
+
+private:
+    struct Reader {
+        int id = 0;
+        QString port;
+        QObject* receiver = nullptr;
+        int fd = -1;
+        bool openFailed = false;            // Warned once until the port opens
+        FrameParser parser;
+        quint64 errorsReported = 0;
+        MetricCounter* frames = nullptr;
+        MetricCounter* errors = nullptr;
+        QString lastTag;
+        QElapsedTimer lastDelivery;
+
+        Reader(bool checksum) : parser(checksum) {}
+    };
+
+    bool openPort(Reader *reader);
+    void closePort(Reader *reader);
+    void readPort(Reader *reader);
+
+private:
+    QThread* m_thread;
+    QSocketNotifier* m_notifier = nullptr;
+    QTimer* m_reopenTimer = nullptr;
+    int m_epollFd = -1;
+    int m_repeatInterval;
+    QMutex m_mutex;
+    QHash<int, Reader*> m_readers;          // By id given to epoll
+    int m_nextId = 0;
+};
+
+#endif // RFIDIOSERVICE_H
@@ -1,19 +1,28 @@
 #include "rpigpio.h"
 
 #include <QtDebug>
-#include <QTimer>
+#include <QMutex>
 
 extern "C" {
 #include "gertboard/gb_common.h"
 }
 
+#include "gpiobank.h"
+#include "gpiobatch.h"
+
+// Function select and pull registers are shared by all pins, boxes may configure them from several threads
+static QMutex configMutex;
+
 // Output GPIO
 RpiGpio::RpiGpio(int gpio, QObject *parent) :
     GpioInterface(GpioInterface::Out, GpioInterface::NoPull, parent)
   , m_gpio(gpio)
 {
-    inputGpioConfig(m_gpio);
-    outputGpioConfig(m_gpio);
+    {
+        QMutexLocker locker(&configMutex);
+        inputGpioConfig(m_gpio);
+        outputGpioConfig(m_gpio);
+    }
 
     setGpioInternal(on());
 }
@@ -22,20 +31,23 @@ RpiGpio::RpiGpio(int gpio, QObject *parent) :
 RpiGpio::RpiGpio(int gpio, GpioInterface::PullType pullType, int pollInterval, QObject* parent) :
     GpioInterface(GpioInterface::In, pullType, parent)
   , m_gpio(gpio)
-  , m_pollTimer(new QTimer(this))
 {
-    inputGpioConfig(m_gpio);
-    setPullType(m_gpio, pullType);
+    {
+        QMutexLocker locker(&configMutex);
+        inputGpioConfig(m_gpio);
+        setPullType(m_gpio, pullType);
+    }
 
-    m_pollTimer->setInterval(pollInterval);
-    m_pollTimer->setSingleShot(false);
-    connect(m_pollTimer, &QTimer::timeout, this, &RpiGpio::checkInput);
-    m_pollTimer->start();
+    // Sampled with all other inputs by the bank
+    checkInput();
+    GpioBank::instance()->addInput(this, m_gpio, pollInterval);
 }
 
 RpiGpio::~RpiGpio()
 {
     if (type() == GpioInterface::In) {
+        GpioBank::instance()->removeInput(this);
+        QMutexLocker locker(&configMutex);
         setPullType(m_gpio, NoPull);
     }
 }
@@ -44,27 +56,54 @@ void RpiGpio::initialize()
 {
     qDebug() << "[RpiGpio] Initialize gpio.";
     setup_io();
+    GpioBank::create();
+    GpioBatch::setWriter(writeGpioMasks);
 }
 
 void RpiGpio::cleanUp()
 {
     qDebug() << "[RpiGpio] Restore gpio.";
+    GpioBank::destroy();
+    GpioBatch::setWriter(nullptr);
     restore_io();
 }
 
 
 void RpiGpio::setGpioInternal(bool on)
 {
-    if (type() == GpioInterface::Out) {
+    if (type() != GpioInterface::Out) return;
+
+    // Written with the other changes of the batch
+    GpioBatch* batch = GpioBatch::current();
+    if (batch && GpioBatch::writer()) {
+        if (on) batch->set(m_gpio);
+        else    batch->clear(m_gpio);
+    }
+    else {
         if (on) setGpio(m_gpio);
         else    clearGpio(m_gpio);
     }
 //    else qDebug() << "Gpio " << m_gpio << " : " << on;
 }
 
+// Clear register write, safe from any thread
+void RpiGpio::directOff()
+{
+    if (type() != GpioInterface::Out) return;
+
+    GpioBatch* batch = GpioBatch::current();
+    if (batch && GpioBatch::writer()) batch->clear(m_gpio);
+    else clearGpio(m_gpio);
+}
+
 // Input low is considered activated (pull high case)
 void RpiGpio::checkInput()
 {
-    if (pullType() == GpioInterface::PullUp) setOn(readGpio(m_gpio) == 0);
-    else setOn(readGpio(m_gpio) != 0);
+    setLevel(readGpio(m_gpio) != 0);
+}
+
+void RpiGpio::setLevel(bool high)
+{
+    if (pullType() == GpioInterface::PullUp) setOn(!high);
+    else setOn(high);
 }
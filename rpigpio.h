@@ -3,7 +3,7 @@
 
 #include "gpiointerface.h"
 
-class QTimer;
+class GpioBank;
 
 class RpiGpio : public GpioInterface
 {
@@ -17,6 +17,9 @@ public:
     static void initialize();
     static void cleanUp();
 
+    bool hasDirectOff() const override { return type() == GpioInterface::Out; }
+    void directOff() override;
+
     // GpioInterface interface
 protected:
     void setGpioInternal(bool on) override;
@@ -24,9 +27,12 @@ protected:
 private slots:
     void checkInput();
 
+private:
+    friend class GpioBank;
+    void setLevel(bool high);
+
 private:
     int m_gpio;
-    QTimer* m_pollTimer = nullptr;
 };
 
 #endif // RPIGPIO_H
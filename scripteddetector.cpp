@@ -0,0 +1,115 @@
+#include "scripteddetector.h"
+
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QtDebug>
+
+/*
+ * One local server for all scripted detectors, a driver connects and sends lines :
+ *   tag <detector> <id>     tag in range of the detector
+ *   tag <detector>          no more tag, the cow leaves after the detection delay
+ *   list                    names of the detectors, space separated
+ * Each line gets "ok", the list, or "error <reason>" back.
+ * A detector is named by "simName" in its configuration, its "port" otherwise.
+ */
+
+static QMutex detectorsMutex;
+static QHash<QString, QPointer<ScriptedDetector>> detectors;
+static ScriptedDetectorServer* server = nullptr;
+
+ScriptedDetector::ScriptedDetector(const QString &serverName, const QString &name, QObject *parent) :
+    DetectorInterface(parent)
+  , m_name(name)
+{
+    QMutexLocker locker(&detectorsMutex);
+    if (detectors.contains(m_name)) qWarning() << "[ScriptedDetector] Detector name used twice : " << m_name;
+    detectors.insert(m_name, this);
+
+    // Boxes may be created in worker threads, the server is handed to the main thread
+    if (!server) {
+        server = new ScriptedDetectorServer(serverName);
+        server->moveToThread(QCoreApplication::instance()->thread());
+        QMetaObject::invokeMethod(server, "listen", Qt::QueuedConnection);
+    }
+}
+
+ScriptedDetector::~ScriptedDetector()
+{
+    QMutexLocker locker(&detectorsMutex);
+    if (detectors.value(m_name) == this) detectors.remove(m_name);
+}
+
+void ScriptedDetector::shutdown()
+{
+    QMutexLocker locker(&detectorsMutex);
+    delete server;
+    server = nullptr;
+}
+
+void ScriptedDetector::setDetected(const QString &id)
+{
+    setId(id);
+}
+
+ScriptedDetectorServer::ScriptedDetectorServer(const QString &serverName, QObject *parent) :
+    QObject(parent)
+  , m_serverName(serverName)
+{
+}
+
+void ScriptedDetectorServer::listen()
+{
+    m_server = new QLocalServer(this);
+    QLocalServer::removeServer(m_serverName);       // Left by a crashed run
+    if (!m_server->listen(m_serverName)) {
+        qWarning() << "[ScriptedDetector] Server error : " << m_serverName << m_server->errorString();
+        return;
+    }
+    connect(m_server, &QLocalServer::newConnection, this, &ScriptedDetectorServer::newConnection);
+    qDebug() << "[ScriptedDetector] Listening on " << m_server->fullServerName();
+}
+
+void ScriptedDetectorServer::newConnection()
+{
+    while (QLocalSocket* socket = m_server->nextPendingConnection()) {
+        connect(socket, &QLocalSocket::readyRead, this, &ScriptedDetectorServer::readCommands);
+        connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+void ScriptedDetectorServer::readCommands()
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket) return;
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine().trimmed();
+        if (line.isEmpty()) continue;
+        socket->write(command(line) + '\n');
+    }
+}
+
+QByteArray ScriptedDetectorServer::command(const QByteArray &line)
+{
+    QList<QByteArray> words = line.simplified().split(' ');
+    QMutexLocker locker(&detectorsMutex);
+
+    if (words.first() == "list") {
+        QStringList names = detectors.keys();
+        names.sort();
+        return names.join(' ').toUtf8();
+    }
+    if (words.first() == "tag" && words.count() >= 2 && words.count() <= 3) {
+        ScriptedDetector* detector = detectors.value(QString::fromUtf8(words.at(1)));
+        if (!detector) return "error unknown detector";
+
+        // Posted under the lock, a detector being deleted drops it with its other events
+        QString id = words.count() == 3 ? QString::fromUtf8(words.at(2)) : QString();
+        QMetaObject::invokeMethod(detector, "setDetected", Qt::QueuedConnection, Q_ARG(QString, id));
+        return "ok";
+    }
+    return "error unknown command";
+}
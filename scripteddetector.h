@@ -0,0 +1,50 @@
+#ifndef SCRIPTEDDETECTOR_H
+#define SCRIPTEDDETECTOR_H
+
+#include "detectorinterface.h"
+
+class QLocalServer;
+
+// Detector of the "sim" backend, tags are set by test drivers through a local socket
+class ScriptedDetector : public DetectorInterface
+{
+    Q_OBJECT
+
+public:
+    ScriptedDetector(const QString &serverName, const QString &name, QObject *parent = 0);
+    ~ScriptedDetector();
+
+    QString name() const { return m_name; }
+
+    // Closes the server, once all detectors are deleted
+    static void shutdown();
+
+public slots:
+    void setDetected(const QString &id);
+
+private:
+    QString m_name;
+};
+
+// Shared by all detectors, lives in the main thread
+class ScriptedDetectorServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScriptedDetectorServer(const QString &serverName, QObject *parent = 0);
+
+private slots:
+    void listen();
+    void newConnection();
+    void readCommands();
+
+private:
+    QByteArray command(const QByteArray &line);
+
+private:
+    QString m_serverName;
+    QLocalServer* m_server = nullptr;
+};
+
+#endif // SCRIPTEDDETECTOR_H
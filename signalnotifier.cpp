@@ -0,0 +1,65 @@
+#include "signalnotifier.h"
+
+#include <QSocketNotifier>
+#include <QtDebug>
+
+#ifndef Q_OS_WIN
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
+
+/*
+ * Only a write on a socket pair is done in the handler, anything else is not async signal safe.
+ * The notifier reads it in the event loop and emits activated.
+ */
+
+#ifndef Q_OS_WIN
+static int signalSockets[NSIG][2];
+
+static void signalHandler(int signal)
+{
+    char byte = 1;
+    if (::write(signalSockets[signal][0], &byte, sizeof(byte)) < 0) return;
+}
+#endif
+
+SignalNotifier::SignalNotifier(int signal, QObject *parent) :
+    QObject(parent)
+  , m_signal(signal)
+{
+#ifndef Q_OS_WIN
+    if (signal <= 0 || signal >= NSIG || ::socketpair(AF_UNIX, SOCK_STREAM, 0, signalSockets[signal]) != 0) {
+        qWarning() << "[SignalNotifier] No signal socket, signal " << signal << " is not handled.";
+        return;
+    }
+    QSocketNotifier* notifier = new QSocketNotifier(signalSockets[signal][1], QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &SignalNotifier::readSocket);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signalHandler;
+    action.sa_flags = SA_RESTART;
+    sigaction(signal, &action, nullptr);
+    m_valid = true;
+#endif
+}
+
+SignalNotifier::~SignalNotifier()
+{
+#ifndef Q_OS_WIN
+    if (!m_valid) return;
+    ::signal(m_signal, SIG_DFL);
+    ::close(signalSockets[m_signal][0]);
+    ::close(signalSockets[m_signal][1]);
+#endif
+}
+
+void SignalNotifier::readSocket()
+{
+#ifndef Q_OS_WIN
+    char byte;
+    if (::read(signalSockets[m_signal][1], &byte, sizeof(byte)) < 0) return;
+#endif
+    emit activated();
+}
@@ -0,0 +1,28 @@
+#ifndef SIGNALNOTIFIER_H
+#define SIGNALNOTIFIER_H
+
+#include <QObject>
+
+// Unix signal delivered as a Qt signal in the thread creating the notifier, one notifier per signal.
+// The previous disposition is not kept, the default one is set back on delete. Does nothing on Windows.
+class SignalNotifier : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SignalNotifier(int signal, QObject *parent = 0);
+    ~SignalNotifier();
+
+    bool isValid() const { return m_valid; }
+
+signals:
+    void activated();
+
+private slots:
+    void readSocket();
+
+private:
+    int m_signal;
+    bool m_valid = false;
+};
+
+#endif // SIGNALNOTIFIER_H
@@ -0,0 +1,87 @@
+#include "simgpio.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QtDebug>
+#include <string.h>
+
+#include "clock.h"
+
+/*
+ * Simulated GPIO bank shared through a mapped file, so test drivers in other processes
+ * read the relays and press the buttons while the daemon runs without /dev/mem.
+ * Layout : "CDGP", quint32 version (1), quint32 pin count, 4 reserved bytes, then one byte per pin.
+ * A byte is the logical state, non zero when the output is on or the input is activated,
+ * pull-up inputs are not inverted. Pins go up to PinCount so many boxes get distinct numbers.
+ */
+
+static QMutex bankMutex;
+static QHash<QString, uchar*> banks;        // Mapped for the process lifetime
+
+static uchar* mapBank(const QString &fileName)
+{
+    QMutexLocker locker(&bankMutex);
+    uchar* bank = banks.value(fileName);
+    if (bank) return bank;
+
+    QFile* file = new QFile(fileName);
+    qint64 size = SimGpio::HeaderSize + SimGpio::PinCount;
+    if (!file->open(QIODevice::ReadWrite) || (file->size() < size && !file->resize(size))) {
+        qWarning() << "[SimGpio] Bank file error : " << fileName << file->errorString();
+        delete file;
+        return nullptr;
+    }
+    bank = file->map(0, size);
+    if (!bank) {
+        qWarning() << "[SimGpio] Bank map error : " << fileName << file->errorString();
+        delete file;
+        return nullptr;
+    }
+
+    // Header rewritten, pins keep the values left by drivers started before us
+    quint32 header[3] = { 0x50474443, 1, SimGpio::PinCount };    // "CDGP" in little endian
+    memcpy(bank, header, sizeof(header));
+    banks.insert(fileName, bank);
+    return bank;
+}
+
+// Output GPIO
+SimGpio::SimGpio(const QString &bankFile, int gpio, QObject *parent) :
+    GpioInterface(GpioInterface::Out, GpioInterface::NoPull, parent)
+{
+    uchar* bank = gpio >= 0 && gpio < PinCount ? mapBank(bankFile) : nullptr;
+    if (bank) m_level = bank + HeaderSize + gpio;
+    setGpioInternal(on());
+}
+
+// Input GPIO
+SimGpio::SimGpio(const QString &bankFile, int gpio, GpioInterface::PullType pullType, int pollInterval, QObject *parent) :
+    GpioInterface(GpioInterface::In, pullType, parent)
+{
+    uchar* bank = gpio >= 0 && gpio < PinCount ? mapBank(bankFile) : nullptr;
+    if (!bank) return;
+    m_level = bank + HeaderSize + gpio;
+
+    checkInput();
+    // Polled on the process clock, like the rest of a simulated box
+    m_pollTimer = new ClockTimer(this);
+    m_pollTimer->setInterval(pollInterval);
+    connect(m_pollTimer, &ClockTimer::timeout, this, &SimGpio::checkInput);
+    m_pollTimer->start();
+}
+
+SimGpio::~SimGpio()
+{
+}
+
+void SimGpio::setGpioInternal(bool on)
+{
+    if (type() != GpioInterface::Out || !m_level) return;
+    *m_level = on ? 1 : 0;
+}
+
+void SimGpio::checkInput()
+{
+    setOn(*m_level != 0);
+}
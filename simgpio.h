@@ -0,0 +1,35 @@
+#ifndef SIMGPIO_H
+#define SIMGPIO_H
+
+#include "gpiointerface.h"
+
+class ClockTimer;
+
+// GPIO of the "sim" backend, one byte per pin in a file mapped by every process using the same bank
+class SimGpio : public GpioInterface
+{
+    Q_OBJECT
+
+public:
+    explicit SimGpio(const QString &bankFile, int gpio, QObject* parent = nullptr);                                     // Output
+    explicit SimGpio(const QString &bankFile, int gpio, PullType pullType, int pollInterval, QObject* parent = nullptr);   // Input
+    ~SimGpio();
+
+    bool isValid() const { return m_level != nullptr; }
+
+    static const int PinCount = 1024;
+    static const int HeaderSize = 16;
+
+    // GpioInterface interface
+protected:
+    void setGpioInternal(bool on) override;
+
+private slots:
+    void checkInput();
+
+private:
+    volatile uchar* m_level = nullptr;
+    ClockTimer* m_pollTimer = nullptr;
+};
+
+#endif // SIMGPIO_H
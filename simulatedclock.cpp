@@ -0,0 +1,72 @@
+#include "simulatedclock.h"
+
+#include <QCoreApplication>
+
+/*
+ * Clock for replays and soak runs : time only moves with advance(), so a feeding day
+ * runs as fast as the code. Boxes should stay in the main thread (boxThreads = 0),
+ * timers of another thread are fired by a queued call and not waited for.
+ */
+
+SimulatedClock::SimulatedClock(const QDateTime &start, QObject *parent) :
+    Clock(parent)
+  , m_now(start.toMSecsSinceEpoch())
+{
+}
+
+QDateTime SimulatedClock::now() const
+{
+    QMutexLocker locker(&m_mutex);
+    return QDateTime::fromMSecsSinceEpoch(m_now);
+}
+
+void SimulatedClock::advance(qint64 ms)
+{
+    qint64 target;
+    {
+        QMutexLocker locker(&m_mutex);
+        target = m_now + qMax(qint64(0), ms);
+    }
+
+    forever {
+        QCoreApplication::processEvents();
+
+        ClockTimer* timer;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_timers.isEmpty() || m_timers.firstKey().first > target) break;
+            m_now = qMax(m_now, m_timers.firstKey().first);
+            timer = m_timers.take(m_timers.firstKey());
+
+            // Periodic timers are due again one interval later
+            if (!timer->m_singleShot) {
+                timer->m_deadline = qMakePair(m_now + qMax(1, timer->m_interval), m_sequence++);
+                m_timers.insert(timer->m_deadline, timer);
+            }
+        }
+
+        if (timer->thread() == thread()) fire(timer);
+        else QMetaObject::invokeMethod(timer, [this, timer]() { if (timer->m_active) fire(timer); }, Qt::QueuedConnection);
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_now = qMax(m_now, target);
+}
+
+void SimulatedClock::advanceTo(const QDateTime &time)
+{
+    advance(now().msecsTo(time));
+}
+
+void SimulatedClock::schedule(ClockTimer *timer)
+{
+    QMutexLocker locker(&m_mutex);
+    timer->m_deadline = qMakePair(m_now + qMax(0, timer->m_interval), m_sequence++);
+    m_timers.insert(timer->m_deadline, timer);
+}
+
+void SimulatedClock::cancel(ClockTimer *timer)
+{
+    QMutexLocker locker(&m_mutex);
+    m_timers.remove(timer->m_deadline);
+}
@@ -0,0 +1,33 @@
+#ifndef SIMULATEDCLOCK_H
+#define SIMULATEDCLOCK_H
+
+#include <QMap>
+#include <QMutex>
+
+#include "clock.h"
+
+// Virtual time only moving forward when advanced, timers fire in deadline order
+class SimulatedClock : public Clock
+{
+    Q_OBJECT
+public:
+    explicit SimulatedClock(const QDateTime &start, QObject *parent = 0);
+
+    QDateTime now() const override;
+
+    // Fires every timer due before the given time, events posted meanwhile are processed
+    void advance(qint64 ms);
+    void advanceTo(const QDateTime &time);
+
+protected:
+    void schedule(ClockTimer *timer) override;
+    void cancel(ClockTimer *timer) override;
+
+private:
+    mutable QMutex m_mutex;
+    qint64 m_now;                                       // ms since epoch
+    quint64 m_sequence = 0;
+    QMap<QPair<qint64, quint64>, ClockTimer*> m_timers;  // By deadline, same deadline in start order
+};
+
+#endif // SIMULATEDCLOCK_H
@@ -0,0 +1,156 @@
+#include "sqlstatements.h"
+
+#include <QtSql>
+#include <QtDebug>
+#include <QMutex>
+#include <QElapsedTimer>
+#include <algorithm>
+
+#include "metrics.h"
+#include "tracer.h"
+
+/*
+ * Each statement is prepared once per connection and executed again with new bound values,
+ * QPSQL keeps it server side so only the first execution is parsed and planned.
+ * Each open of a connection starts a new generation, statements of an older one are prepared
+ * again (a reopened connection may get the same driver handle address, it can't tell).
+ * A failed execution also forces a new prepare at next use.
+ */
+
+struct Statement {
+    QSqlQuery query;
+    quint64 generation = 0;
+    bool valid = false;
+};
+
+static const int MaxStatements = 256;          // Per connection, multi rows inserts have one statement per row count
+
+static QMutex s_mutex;
+static QHash<QString, QHash<QString, Statement*>> s_statements;    // By connection, then sql
+static QHash<QString, quint64> s_generations;                      // By connection
+static QHash<const QSqlQuery*, Statement*> s_byQuery;
+static QHash<QString, SqlStatements::Statistics> s_statistics;
+static QHash<QString, MetricHistogram*> s_histograms;            // By sql, multi rows variants share one
+
+// Statement name for metrics labels : the sql before its values or conditions
+static QString metricLabel(const QString &sql)
+{
+    QString label = sql.simplified();
+    for (const char* end : { " VALUES", " WHERE", " SET", " RETURNING" }) {
+        int position = label.indexOf(QLatin1String(end), 0, Qt::CaseInsensitive);
+        if (position > 0) label.truncate(position);
+    }
+    label = label.left(80).replace('\\', ' ').replace('"', '\'');
+    return QString("statement=\"%1\"").arg(label);
+}
+
+QSqlQuery* SqlStatements::prepared(const QSqlDatabase &db, const QString &sql)
+{
+    QMutexLocker locker(&s_mutex);
+    quint64 generation = s_generations.value(db.connectionName());
+    QHash<QString, Statement*> &statements = s_statements[db.connectionName()];
+    Statement* statement = statements.value(sql);
+    if (statement && statement->valid && statement->generation == generation) {
+        statement->query.finish();
+        return &statement->query;
+    }
+
+    if (!statement) {
+        if (statements.count() >= MaxStatements) {
+            qWarning() << "[SqlStatements] Too many statements on " << db.connectionName() << ", cache cleared.";
+            for (Statement* old : statements) {
+                s_byQuery.remove(&old->query);
+                delete old;
+            }
+            statements.clear();
+        }
+        statement = new Statement;
+        statements.insert(sql, statement);
+        s_byQuery.insert(&statement->query, statement);
+    }
+
+    statement->query = QSqlQuery(db);
+    statement->query.setForwardOnly(true);
+    statement->generation = generation;
+    statement->valid = statement->query.prepare(sql);
+    if (!statement->valid) qWarning() << "[SqlStatements] prepare error : " << statement->query.lastError().text() << sql;
+    return &statement->query;
+}
+
+bool SqlStatements::exec(QSqlQuery *query)
+{
+    // The statement text is only interned when tracing
+    qint64 traceStart = Tracer::isEnabled() ? Tracer::now() : -1;
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = query->exec();
+    qint64 elapsed = timer.nsecsElapsed() / 1000;
+
+    QMutexLocker locker(&s_mutex);
+    Statistics &statistics = s_statistics[query->lastQuery()];
+    statistics.count++;
+    statistics.totalTime += elapsed;
+    statistics.maxTime = qMax(statistics.maxTime, elapsed);
+    if (!ok) {
+        statistics.errors++;
+        Statement* statement = s_byQuery.value(query);
+        if (statement) statement->valid = false;
+    }
+
+    MetricHistogram* &histogram = s_histograms[query->lastQuery()];
+    if (!histogram) histogram = Metrics::histogram("cowdetector_sql_statement_seconds", "Execution time of each prepared statement", metricLabel(query->lastQuery()));
+    histogram->observe(elapsed);
+    locker.unlock();
+
+    if (traceStart >= 0) Tracer::complete("sql", Tracer::intern(query->lastQuery().left(200)), traceStart, elapsed);
+    return ok;
+}
+
+void SqlStatements::opened(const QSqlDatabase &db)
+{
+    QMutexLocker locker(&s_mutex);
+    s_generations[db.connectionName()]++;
+}
+
+int SqlStatements::batchSize(int count, int maximum)
+{
+    if (count >= maximum) return maximum;
+    int size = 1;
+    while (size * 4 <= count) size *= 4;
+    return size;
+}
+
+void SqlStatements::release(const QString &connectionName)
+{
+    QMutexLocker locker(&s_mutex);
+    QHash<QString, Statement*> statements = s_statements.take(connectionName);
+    for (Statement* statement : statements) {
+        s_byQuery.remove(&statement->query);
+        delete statement;
+    }
+}
+
+QList<SqlStatements::Statistics> SqlStatements::statistics()
+{
+    QList<Statistics> statistics;
+    {
+        QMutexLocker locker(&s_mutex);
+        for (auto i = s_statistics.constBegin(); i != s_statistics.constEnd(); i++) {
+            statistics.append(i.value());
+            statistics.last().sql = i.key();
+        }
+    }
+
+    // Most expensive first
+    std::sort(statistics.begin(), statistics.end(), [](const Statistics &a, const Statistics &b) { return a.totalTime > b.totalTime; });
+    return statistics;
+}
+
+void SqlStatements::report()
+{
+    for (const Statistics &statistics : SqlStatements::statistics()) {
+        qDebug() << "[SqlStatements]" << statistics.count << "executions," << statistics.errors << "errors,"
+                 << statistics.totalTime / 1000 << "ms total," << (statistics.count ? statistics.totalTime / qint64(statistics.count) : 0) << "us average,"
+                 << statistics.maxTime << "us max :" << statistics.sql.left(120);
+    }
+}
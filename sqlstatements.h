@@ -0,0 +1,41 @@
+#ifndef SQLSTATEMENTS_H
+#define SQLSTATEMENTS_H
+
+#include <QList>
+#include <QString>
+
+class QSqlQuery;
+class QSqlDatabase;
+
+// Prepared statements kept for the life of their connection, with execution timings
+class SqlStatements
+{
+public:
+    struct Statistics {
+        QString sql;
+        quint64 count = 0;
+        quint64 errors = 0;
+        qint64 totalTime = 0;               // Microseconds
+        qint64 maxTime = 0;
+    };
+
+    // Only used by the thread owning the connection, prepared again when the connection was reopened
+    static QSqlQuery* prepared(const QSqlDatabase &db, const QString &sql);
+    static bool exec(QSqlQuery *query);
+
+    // After each successful open of the connection, statements of the previous session are prepared again
+    static void opened(const QSqlDatabase &db);
+    // Before closing the connection for good
+    static void release(const QString &connectionName);
+
+    // Rows of the next multi rows statement : 1, 4, 16, 64... or the maximum, so few variants are prepared
+    static int batchSize(int count, int maximum);
+
+    static QList<Statistics> statistics();
+    static void report();
+
+private:
+    SqlStatements() {}
+};
+
+#endif // SQLSTATEMENTS_H
@@ -0,0 +1,34 @@
+#include "startupphases.h"
+
+#include <QElapsedTimer>
+#include <QSet>
+#include <QtDebug>
+
+#include "metrics.h"
+
+static QElapsedTimer timer;
+static qint64 lastMark = 0;
+static QSet<QByteArray> marked;
+
+void StartupPhases::begin()
+{
+    timer.start();
+    lastMark = 0;
+}
+
+void StartupPhases::mark(const char *phase)
+{
+    if (!timer.isValid() || marked.contains(phase)) return;
+    marked.insert(phase);
+
+    qint64 now = timer.nsecsElapsed() / 1000;
+    Metrics::histogram("cowdetector_startup_phase_seconds", "Duration of each startup step since the previous one",
+                       QString("phase=\"%1\"").arg(phase))->observe(now - lastMark);
+    qDebug() << "[Startup] " << phase << " : " << (now - lastMark) / 1000 << "ms, " << now / 1000 << "ms since start";
+    lastMark = now;
+}
+
+qint64 StartupPhases::elapsed()
+{
+    return timer.isValid() ? timer.elapsed() : 0;
+}
@@ -0,0 +1,20 @@
+#ifndef STARTUPPHASES_H
+#define STARTUPPHASES_H
+
+#include <QtGlobal>
+
+// Durations of the startup steps, logged and exposed as cowdetector_startup_phase_seconds{phase}.
+// Main thread only.
+class StartupPhases
+{
+public:
+    static void begin();
+
+    // Time since the previous phase, a phase is only recorded the first time
+    static void mark(const char *phase);
+
+    // Milliseconds since begin
+    static qint64 elapsed();
+};
+
+#endif // STARTUPPHASES_H
@@ -0,0 +1,104 @@
+#include "startupsnapshot.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+#include <QtSql>
+#include <QtDebug>
+
+#include "identificationcache.h"
+#include "allocationcache.h"
+#include "boxparameterservice.h"
+#include "consumptionledger.h"
+
+/*
+ * Each cache reads and writes its own table, the whole snapshot is written in one transaction
+ * so a power cut leaves the previous one.
+ */
+
+StartupSnapshot::StartupSnapshot(const QString &fileName) :
+    m_fileName(fileName)
+  , m_connectionName("snapshot")
+{
+}
+
+bool StartupSnapshot::load(IdentificationCache *identifications, AllocationCache *allocations, BoxParameterService *boxParameters, ConsumptionLedger *ledger)
+{
+    if (!QFile::exists(m_fileName)) {
+        qDebug() << "[StartupSnapshot] No snapshot yet : " << m_fileName;
+        return false;
+    }
+    if (!open()) return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    bool ok;
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        ok = identifications->loadSnapshot(db)
+                && allocations->loadSnapshot(db)
+                && boxParameters->loadSnapshot(db)
+                && ledger->loadSnapshot(db);
+    }
+    close();
+    if (ok) qDebug() << "[StartupSnapshot] Snapshot loaded in " << timer.elapsed() << "ms : " << identifications->count() << " identifications";
+    return ok;
+}
+
+bool StartupSnapshot::save(IdentificationCache *identifications, AllocationCache *allocations, BoxParameterService *boxParameters, ConsumptionLedger *ledger)
+{
+    if (!open()) return false;
+
+    bool ok;
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.transaction();
+        ok = identifications->saveSnapshot(db)
+                && allocations->saveSnapshot(db)
+                && boxParameters->saveSnapshot(db)
+                && ledger->saveSnapshot(db);
+        if (ok && !db.commit()) {
+            qWarning() << "[StartupSnapshot] commit error : " << db.lastError().text();
+            ok = false;
+        }
+        if (!ok) db.rollback();
+    }
+    close();
+    return ok;
+}
+
+bool StartupSnapshot::open()
+{
+    QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+    db.setDatabaseName(m_fileName);
+    if (!db.open()) {
+        qWarning() << "[StartupSnapshot] Impossible to open snapshot : " << m_fileName << db.lastError().text();
+        return false;
+    }
+
+    exec("PRAGMA journal_mode = WAL");
+    return exec("CREATE TABLE IF NOT EXISTS identification (rfid TEXT PRIMARY KEY, cow INTEGER, card INTEGER)")
+        && exec("CREATE TABLE IF NOT EXISTS foodallocation (cow INTEGER PRIMARY KEY, fooda INTEGER, foodb INTEGER, mealcount INTEGER, mealdelay INTEGER, eatspeed INTEGER)")
+        && exec("CREATE TABLE IF NOT EXISTS box (boxnumber INTEGER PRIMARY KEY, newdaytime TEXT, idlestart1 TEXT, idlestop1 TEXT, idlestart2 TEXT, idlestop2 TEXT, "
+                "foodspeeda REAL, foodspeedb REAL, calibrationtime INTEGER, mealminimum INTEGER, detectiondelay INTEGER)")
+        && exec("CREATE TABLE IF NOT EXISTS meals (cow INTEGER, entry INTEGER, fooda REAL, foodb REAL)");
+}
+
+void StartupSnapshot::close()
+{
+    if (!QSqlDatabase::contains(m_connectionName)) return;
+    {
+        QSqlDatabase db = QSqlDatabase::database(m_connectionName, false);
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(m_connectionName);
+}
+
+bool StartupSnapshot::exec(const QString &sql)
+{
+    QSqlQuery query(QSqlDatabase::database(m_connectionName, false));
+    if (!query.exec(sql)) {
+        qWarning() << "[StartupSnapshot] query error : " << sql << query.lastError().text();
+        return false;
+    }
+    return true;
+}
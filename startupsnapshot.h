@@ -0,0 +1,34 @@
+#ifndef STARTUPSNAPSHOT_H
+#define STARTUPSNAPSHOT_H
+
+#include <QString>
+
+class IdentificationCache;
+class AllocationCache;
+class BoxParameterService;
+class ConsumptionLedger;
+
+/*
+ * Local SQLite copy of the caches loaded from Postgres : identifications, allocations,
+ * box parameters and the meals of the ledger. Loaded at start so boxes feed at once,
+ * the database replaces it when it answers. Only used from the main thread.
+ */
+class StartupSnapshot
+{
+public:
+    explicit StartupSnapshot(const QString &fileName);
+
+    bool load(IdentificationCache *identifications, AllocationCache *allocations, BoxParameterService *boxParameters, ConsumptionLedger *ledger);
+    bool save(IdentificationCache *identifications, AllocationCache *allocations, BoxParameterService *boxParameters, ConsumptionLedger *ledger);
+
+private:
+    bool open();
+    void close();
+    bool exec(const QString &sql);
+
+private:
+    QString m_fileName;
+    QString m_connectionName;
+};
+
+#endif // STARTUPSNAPSHOT_H
@@ -0,0 +1,133 @@
+#include "tcpreader.h"
+
+#include <QTcpSocket>
+#include <QTimer>
+#include <QtDebug>
+
+#include "metrics.h"
+#include "tracer.h"
+
+/*
+ * Ethernet readers (or serial servers in front of Innovation readers) accept one TCP connection
+ * and send the same frames as on the serial line. Without a tag in range line, the tag is lost
+ * when no frame came for "tagTimeout" ms, readers repeat the frame while the tag is in range.
+ * The connection is retried with a doubling delay, from 1 s up to "reconnectMaximum" ms.
+ * tools/fakereader serves frames on a local port to test against.
+ */
+
+static const int ReconnectMinimum = 1000;
+static const int ConnectTimeout = 5000;
+
+TcpReader::TcpReader(const QJsonObject &config, QObject *parent) :
+    DetectorInterface(parent)
+  , m_config(config)
+  , m_socket(new QTcpSocket(this))
+  , m_reconnectTimer(new QTimer(this))
+  , m_connectTimeout(new QTimer(this))
+  , m_tagTimer(new QTimer(this))
+  , m_parser(config.value("checksum").toBool(true))
+  , m_reconnectDelay(ReconnectMinimum)
+  , m_frames(Metrics::counter("cowdetector_rfid_frames_total", "Valid frames read from RFID readers", QString("port=\"%1\"").arg(QString("%1:%2").arg(config.value("host").toString()).arg(config.value("port").toInt(10001)))))
+  , m_errors(Metrics::counter("cowdetector_rfid_errors_total", "Checksum and framing errors of RFID readers", QString("port=\"%1\"").arg(QString("%1:%2").arg(config.value("host").toString()).arg(config.value("port").toInt(10001)))))
+  , m_reconnects(Metrics::counter("cowdetector_reconnects_total", "Connection attempts of databases, readers and ports", "component=\"tcpreader\""))
+{
+    m_reconnectTimer->setSingleShot(true);
+    connect(m_reconnectTimer, &QTimer::timeout, this, &TcpReader::connectToReader);
+    m_connectTimeout->setSingleShot(true);
+    m_connectTimeout->setInterval(ConnectTimeout);
+    connect(m_connectTimeout, &QTimer::timeout, m_socket, &QTcpSocket::abort);
+    m_tagTimer->setSingleShot(true);
+    m_tagTimer->setInterval(m_config.value("tagTimeout").toInt(1500));
+    connect(m_tagTimer, &QTimer::timeout, this, &TcpReader::tagLost);
+
+    connect(m_socket, &QTcpSocket::connected, this, &TcpReader::connected);
+    connect(m_socket, &QTcpSocket::disconnected, this, &TcpReader::disconnected);
+    connect(m_socket, &QTcpSocket::readyRead, this, &TcpReader::readData);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+    connect(m_socket, &QAbstractSocket::errorOccurred, this, &TcpReader::socketError);
+#else
+    connect(m_socket, static_cast<void (QAbstractSocket::*)(QAbstractSocket::SocketError)>(&QAbstractSocket::error), this, &TcpReader::socketError);
+#endif
+
+    connectToReader();
+}
+
+bool TcpReader::isConnected() const
+{
+    return m_socket->state() == QAbstractSocket::ConnectedState;
+}
+
+void TcpReader::connectToReader()
+{
+    if (m_socket->state() != QAbstractSocket::UnconnectedState) return;
+    m_reconnects->add();
+    m_socket->connectToHost(m_config.value("host").toString(), quint16(m_config.value("port").toInt(10001)));
+    m_connectTimeout->start();
+}
+
+void TcpReader::connected()
+{
+    m_connectTimeout->stop();
+    m_reconnectDelay = ReconnectMinimum;
+    m_socket->setSocketOption(QAbstractSocket::KeepAliveOption, 1);
+    m_socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+    qDebug() << "TCP reader connected on : " << m_socket->peerName() << m_socket->peerPort();
+}
+
+void TcpReader::disconnected()
+{
+    qWarning() << "TCP reader disconnected : " << m_config.value("host").toString() << m_config.value("port").toInt(10001);
+    scheduleReconnect();
+}
+
+void TcpReader::socketError(QAbstractSocket::SocketError error)
+{
+    Q_UNUSED(error);
+    // Connection refused or timed out, an established one ends in disconnected
+    if (m_socket->state() != QAbstractSocket::ConnectedState) {
+        qWarning() << "TCP reader connection error : " << m_config.value("host").toString() << m_socket->errorString();
+        m_socket->abort();
+        scheduleReconnect();
+    }
+}
+
+void TcpReader::scheduleReconnect()
+{
+    m_connectTimeout->stop();
+    if (m_reconnectTimer->isActive()) return;
+    m_reconnectTimer->start(m_reconnectDelay);
+    m_reconnectDelay = qMin(m_reconnectDelay * 2, m_config.value("reconnectMaximum").toInt(30000));
+}
+
+void TcpReader::readData()
+{
+    TRACE_SCOPE("readData");
+    char frameId[FrameParser::IdLength];
+    forever {
+        int size;
+        char* data = m_parser.writePointer(&size);
+        qint64 count = size > 0 ? m_socket->read(data, size) : 0;
+        if (count <= 0) break;
+        m_parser.commit(int(count));
+        while (m_parser.next(frameId)) {
+            m_frames->add();
+            m_tagTimer->start();
+            setId(QString::fromLatin1(frameId, FrameParser::IdLength), Metrics::now());
+        }
+    }
+
+    const FrameParser::Statistics &statistics = m_parser.statistics();
+    quint64 errors = statistics.checksumErrors + statistics.framingErrors;
+    if (errors != m_errorsReported) {
+        qWarning() << "TCP reader " << m_config.value("host").toString() << " errors, checksum : " << statistics.checksumErrors
+                   << " framing : " << statistics.framingErrors << " dropped bytes : " << statistics.droppedBytes
+                   << " frames : " << statistics.frames;
+        m_errors->add(errors - m_errorsReported);
+        m_errorsReported = errors;
+    }
+}
+
+void TcpReader::tagLost()
+{
+    setId(QString());
+}
@@ -0,0 +1,50 @@
+#ifndef TCPREADER_H
+#define TCPREADER_H
+
+#include <QJsonObject>
+#include <QAbstractSocket>
+
+#include "detectorinterface.h"
+#include "frameparser.h"
+
+class QTcpSocket;
+class QTimer;
+class MetricCounter;
+
+// RFID reader on the network, sending the Innovation frames over TCP ("host", "port")
+class TcpReader : public DetectorInterface
+{
+    Q_OBJECT
+
+public:
+    TcpReader(const QJsonObject &config, QObject *parent = 0);
+
+    bool isConnected() const;
+    const FrameParser::Statistics& statistics() const { return m_parser.statistics(); }
+
+private slots:
+    void connectToReader();
+    void connected();
+    void disconnected();
+    void socketError(QAbstractSocket::SocketError error);
+    void readData();
+    void tagLost();
+
+private:
+    void scheduleReconnect();
+
+private:
+    QJsonObject m_config;
+    QTcpSocket* m_socket;
+    QTimer* m_reconnectTimer;
+    QTimer* m_connectTimeout;
+    QTimer* m_tagTimer;                     // No frame for a while, the tag is out of range
+    FrameParser m_parser;
+    int m_reconnectDelay;
+    quint64 m_errorsReported = 0;
+    MetricCounter* m_frames;
+    MetricCounter* m_errors;
+    MetricCounter* m_reconnects;
+};
+
+#endif // TCPREADER_H
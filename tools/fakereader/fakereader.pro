@@ -0,0 +1,10 @@
+QT += core network
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = fakereader
+TEMPLATE = app
+
+SOURCES += main.cpp
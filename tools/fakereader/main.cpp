@@ -0,0 +1,87 @@
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QTimer>
+
+#include <unistd.h>
+
+/*
+ * Fake network RFID reader to test the TcpReader detector.
+ *   fakereader [port] [frame interval ms]
+ * Commands on stdin :
+ *   <tag>       10 hex characters, repeated to the connected clients while in range
+ *   (empty)     no more tag
+ *   drop        closes the client connections, the detector has to reconnect
+ *   bad         sends one frame with a wrong checksum
+ */
+
+static QByteArray frame(const QByteArray &tag, bool goodChecksum = true)
+{
+    static const char Hex[] = "0123456789ABCDEF";
+    int checksum = 0;
+    for (int i = 0; i + 1 < tag.size(); i += 2) checksum ^= tag.mid(i, 2).toInt(nullptr, 16);
+    if (!goodChecksum) checksum ^= 0x01;
+    return '\x02' + tag + Hex[checksum >> 4] + Hex[checksum & 0x0F] + "\r\n\x03";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+    quint16 port = quint16(arguments.value(1, "10001").toUInt());
+    int interval = arguments.value(2, "250").toInt();
+    QTextStream out(stdout);
+
+    QTcpServer server;
+    QList<QTcpSocket*> clients;
+    if (!server.listen(QHostAddress::Any, port)) {
+        out << "Listen error : " << server.errorString() << "\n";
+        return 1;
+    }
+    QObject::connect(&server, &QTcpServer::newConnection, [&]() {
+        while (QTcpSocket* client = server.nextPendingConnection()) {
+            out << "Client connected " << client->peerAddress().toString() << "\n";
+            out.flush();
+            clients.append(client);
+            QObject::connect(client, &QTcpSocket::disconnected, [&clients, client]() {
+                clients.removeAll(client);
+                client->deleteLater();
+            });
+        }
+    });
+
+    QByteArray tag;
+    auto send = [&clients](const QByteArray &data) {
+        for (QTcpSocket* client : clients) client->write(data);
+    };
+
+    QTimer timer;
+    timer.setInterval(interval);
+    QObject::connect(&timer, &QTimer::timeout, [&]() { if (!tag.isEmpty()) send(frame(tag)); });
+    timer.start();
+
+    QSocketNotifier input(STDIN_FILENO, QSocketNotifier::Read);
+    QTextStream in(stdin);
+    QObject::connect(&input, &QSocketNotifier::activated, [&]() {
+        QString line = in.readLine();
+        if (line.isNull()) {
+            app.quit();
+            return;
+        }
+        line = line.trimmed();
+        if (line == "drop") {
+            const QList<QTcpSocket*> dropped = clients;          // Removed from clients while aborted
+            for (QTcpSocket* client : dropped) client->abort();
+        }
+        else if (line == "bad") send(frame(tag.isEmpty() ? QByteArray("0000000000") : tag, false));
+        else tag = line.toLatin1().toUpper();
+        out << "Tag : " << (tag.isEmpty() ? QString("none") : QString::fromLatin1(tag)) << ", clients : " << clients.count() << "\n";
+        out.flush();
+    });
+
+    out << "Fake reader listening on port " << port << "\n";
+    out.flush();
+    return app.exec();
+}
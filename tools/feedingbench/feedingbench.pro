@@ -0,0 +1,16 @@
+QT += core
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = feedingbench
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../feedingpolicy.cpp
+
+HEADERS += \
+    ../../feedingpolicy.h
@@ -0,0 +1,122 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QVector>
+#include <QTextStream>
+
+#include "feedingpolicy.h"
+
+/*
+ * Benchmark of the feeding policy on synthetic cows, no database nor GPIO.
+ *   feedingbench [decisions] [cows] [seed]
+ * First part times raw decisions, second part replays a day of visits per cow
+ * and checks the rations : a policy change must not give more than the allocation.
+ */
+
+static FoodAllocation randomAllocation(QRandomGenerator &random)
+{
+    FoodAllocation allocation;
+    allocation.foodA = random.bounded(0, 8000);
+    allocation.foodB = random.bounded(0, 4000);
+    allocation.mealCount = random.bounded(0, 4) == 0 ? random.bounded(1, 8) : -1;
+    allocation.mealDelay = random.bounded(0, 4) == 0 ? random.bounded(30, 360) : -1;
+    allocation.eatSpeed = random.bounded(3, 10);
+    return allocation;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+    qint64 decisions = arguments.value(1, "5000000").toLongLong();
+    int cows = arguments.value(2, "500").toInt();
+    QRandomGenerator random(arguments.value(3, "1").toUInt());
+    QTextStream out(stdout);
+
+    BoxParameters parameters;
+    parameters.foodSpeedA = 7.0;
+    parameters.foodSpeedB = 7.0;
+    QDateTime now(QDate(2024, 1, 1), QTime(12, 0));
+
+    // Synthetic states prepared in advance so only the policy is timed
+    QVector<FeedingState> states(4096);
+    for (FeedingState &state : states) {
+        state.allocation = randomAllocation(random);
+        state.entry = now.addMSecs(-random.bounded(0, 600000));
+        state.mealA = random.bounded(0, 500);
+        state.mealB = random.bounded(0, 500);
+        state.eatenTodayA = random.bounded(0, qMax(1, state.allocation.foodA + 500));
+        state.eatenTodayB = random.bounded(0, qMax(1, state.allocation.foodB + 500));
+        state.eatenIntervalA = qMin(state.eatenTodayA, qreal(random.bounded(0, 2000)));
+        state.eatenIntervalB = qMin(state.eatenTodayB, qreal(random.bounded(0, 1000)));
+    }
+
+    qint64 actions[4] = {0, 0, 0, 0};
+    qreal given = 0.0;
+    QElapsedTimer timer;
+    timer.start();
+    for (qint64 i = 0; i < decisions; i++) {
+        FeedingDecision decision = FeedingPolicy::decide(states.at(i & (states.count() - 1)), parameters, now);
+        actions[decision.action]++;
+        given += decision.foodA + decision.foodB;
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    out << decisions << " decisions in " << elapsed / 1000000 << " ms, " << (decisions ? elapsed / decisions : 0) << " ns per decision\n";
+    out << "  dispense " << actions[FeedingDecision::Dispense] << ", wait " << actions[FeedingDecision::Wait]
+        << ", zero allocation " << actions[FeedingDecision::ZeroAllocation] << ", zero speed " << actions[FeedingDecision::ZeroSpeed]
+        << ", " << qRound64(given / 1000) << " kg given\n";
+
+    // A day of visits : each cow comes back at random, the policy decides until it waits
+    qint64 visits = 0;
+    qint64 overfed = 0;
+    qreal rationA = 0.0, rationB = 0.0, fedA = 0.0, fedB = 0.0;
+    QDateTime dayStart(QDate(2024, 1, 1), parameters.newDayTime);
+    timer.restart();
+    for (int cow = 0; cow < cows; cow++) {
+        FoodAllocation allocation = randomAllocation(random);
+        QVector<QPair<QDateTime, QPair<qreal, qreal>>> meals;
+        qreal todayA = 0.0, todayB = 0.0;
+        QDateTime time = dayStart;
+        while ((time = time.addSecs(random.bounded(600, 4 * 3600))) < dayStart.addDays(1)) {
+            FeedingState state;
+            state.allocation = allocation;
+            state.entry = time;
+            state.eatenTodayA = todayA;
+            state.eatenTodayB = todayB;
+            QDateTime since = time.addSecs(-FeedingPolicy::mealInterval(allocation));
+            for (const auto &meal : meals) {
+                if (meal.first <= since) continue;
+                state.eatenIntervalA += meal.second.first;
+                state.eatenIntervalB += meal.second.second;
+            }
+            visits++;
+
+            // The cow stays until the policy asks to come back later
+            QDateTime check = time;
+            forever {
+                FeedingDecision decision = FeedingPolicy::decide(state, parameters, check);
+                if (decision.action != FeedingDecision::Dispense) break;
+                state.mealA += decision.foodA;
+                state.mealB += decision.foodB;
+                state.eatenTodayA += decision.foodA;
+                state.eatenTodayB += decision.foodB;
+                state.eatenIntervalA += decision.foodA;
+                state.eatenIntervalB += decision.foodB;
+                check = check.addMSecs(decision.nextCheck);
+            }
+            meals.append(qMakePair(time, qMakePair(state.mealA, state.mealB)));
+            todayA = state.eatenTodayA;
+            todayB = state.eatenTodayB;
+        }
+        if (todayA > allocation.foodA + 1 || todayB > allocation.foodB + 1) overfed++;
+        rationA += allocation.foodA;
+        rationB += allocation.foodB;
+        fedA += todayA;
+        fedB += todayB;
+    }
+    out << cows << " cows, " << visits << " visits simulated in " << timer.elapsed() << " ms\n";
+    out << "  food A " << qRound64(fedA) << " / " << qRound64(rationA) << " gr, food B " << qRound64(fedB) << " / " << qRound64(rationB)
+        << " gr, " << overfed << " cows over their ration\n";
+
+    return overfed == 0 ? 0 : 1;
+}
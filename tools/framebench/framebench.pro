@@ -0,0 +1,16 @@
+QT += core
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = framebench
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../frameparser.cpp
+
+HEADERS += \
+    ../../frameparser.h
@@ -0,0 +1,110 @@
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTextStream>
+
+#include "frameparser.h"
+
+/*
+ * Benchmark of the Innovation reader frame parser.
+ *   framebench [capture files...]
+ * Captures are raw bytes recorded on the serial port (cat /dev/ttyAMA0 > capture.bin).
+ * Without a file, a synthetic capture is made with line noise and bad checksums.
+ * Each capture is fed in chunks of several sizes, like readyRead delivers them,
+ * through the frame parser and through the previous QByteArray based parsing.
+ */
+
+static QByteArray frame(QRandomGenerator &random, bool goodChecksum)
+{
+    static const char Hex[] = "0123456789ABCDEF";
+    QByteArray id;
+    int checksum = 0;
+    for (int i = 0; i < 5; i++) {
+        int value = random.bounded(256);
+        checksum ^= value;
+        id.append(Hex[value >> 4]).append(Hex[value & 0x0F]);
+    }
+    if (!goodChecksum) checksum ^= 0x01;
+    return '\x02' + id + Hex[checksum >> 4] + Hex[checksum & 0x0F] + "\r\n\x03";
+}
+
+static QByteArray syntheticCapture(int frames)
+{
+    QRandomGenerator random(1);
+    QByteArray capture;
+    for (int i = 0; i < frames; i++) {
+        if (random.bounded(100) == 0) capture.append(QByteArray(random.bounded(1, 40), char(random.bounded(256))));
+        QByteArray data = frame(random, random.bounded(200) != 0);
+        if (random.bounded(200) == 0) data.chop(random.bounded(1, 8));             // Cut frame
+        capture.append(data);
+    }
+    return capture;
+}
+
+// Parsing done by InnovationReader::readData before the frame parser, one frame per read
+static int legacyParse(QByteArray &buffer, const QByteArray &chunk)
+{
+    buffer.append(chunk);
+    int endText = buffer.indexOf(0x03);
+    if (endText == -1) return 0;
+    QByteArray data = buffer.left(endText);
+    buffer = buffer.mid(endText + 1);
+    int startText = data.indexOf(0x02);
+    if (startText == -1) return 0;
+    data = data.mid(startText + 1);
+    if (data.count() < 12) return 0;
+    return data.left(10).isEmpty() ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    QList<QPair<QString, QByteArray>> captures;
+    for (const QString &fileName : app.arguments().mid(1)) {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            out << "Can't read " << fileName << "\n";
+            return 1;
+        }
+        captures.append(qMakePair(fileName, file.readAll()));
+    }
+    if (captures.isEmpty()) captures.append(qMakePair(QString("synthetic"), syntheticCapture(200000)));
+
+    for (const auto &capture : captures) {
+        const QByteArray &bytes = capture.second;
+        out << capture.first << " : " << bytes.size() << " bytes\n";
+        out.flush();
+
+        for (int chunkSize : { 1, 7, 16, 64, 512 }) {
+            FrameParser parser;
+            char id[FrameParser::IdLength];
+            quint64 frames = 0;
+            QElapsedTimer timer;
+            timer.start();
+            for (int position = 0; position < bytes.size(); position += chunkSize) {
+                parser.append(bytes.constData() + position, qMin(chunkSize, bytes.size() - position));
+                while (parser.next(id)) frames++;
+            }
+            qint64 parserNs = timer.nsecsElapsed();
+
+            QByteArray buffer;
+            quint64 legacyFrames = 0;
+            timer.restart();
+            for (int position = 0; position < bytes.size(); position += chunkSize) {
+                legacyFrames += legacyParse(buffer, bytes.mid(position, chunkSize));
+            }
+            qint64 legacyNs = timer.nsecsElapsed();
+
+            const FrameParser::Statistics &statistics = parser.statistics();
+            out << "  chunk " << chunkSize << " : parser " << QString::number(bytes.size() * 1000.0 / qMax(qint64(1), parserNs), 'f', 1) << " MB/s, "
+                << frames << " frames, " << statistics.checksumErrors << " checksum errors, " << statistics.framingErrors << " framing errors, "
+                << statistics.droppedBytes << " dropped bytes -- previous " << QString::number(bytes.size() * 1000.0 / qMax(qint64(1), legacyNs), 'f', 1)
+                << " MB/s, " << legacyFrames << " frames, " << buffer.size() << " bytes left\n";
+            out.flush();
+        }
+    }
+    return 0;
+}
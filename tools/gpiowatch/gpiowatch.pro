@@ -0,0 +1,20 @@
+QT += core
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = gpiowatch
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../gpiointerface.cpp \
+    ../../clock.cpp \
+    ../../cdevgpio.cpp
+
+HEADERS += \
+    ../../gpiointerface.h \
+    ../../clock.h \
+    ../../cdevgpio.h
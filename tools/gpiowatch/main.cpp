@@ -0,0 +1,47 @@
+#include <QCoreApplication>
+#include <QTextStream>
+#include <time.h>
+
+#include "cdevgpio.h"
+
+/*
+ * Prints the edges seen on input lines of a GPIO character device, with the delay
+ * between the kernel timestamp and their delivery. Works on a gpio-sim chip.
+ *   gpiowatch /dev/gpiochip0 17 24 25 [--debounce ms] [--pullup]
+ */
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+    if (arguments.count() < 3) {
+        QTextStream(stderr) << "Usage : gpiowatch chip line... [--debounce ms] [--pullup]\n";
+        return -1;
+    }
+
+    int debounce = 10;
+    int index = arguments.indexOf("--debounce");
+    if (index > 0) {
+        debounce = arguments.value(index + 1).toInt();
+        arguments.removeAt(index + 1);
+        arguments.removeAt(index);
+    }
+    GpioInterface::PullType pullType = arguments.removeAll("--pullup") ? GpioInterface::PullUp : GpioInterface::NoPull;
+
+    QTextStream out(stdout);
+    for (const QString &line : arguments.mid(2)) {
+        CdevGpio* gpio = new CdevGpio(arguments.at(1), line.toInt(), pullType, debounce, &app);
+        if (!gpio->isValid()) return -1;
+        out << "line " << line << " : " << (gpio->on() ? "on" : "off") << "\n";
+        out.flush();
+        QObject::connect(gpio, &GpioInterface::onChanged, [gpio, line, &out](bool on) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            qint64 delay = (qint64(now.tv_sec) * 1000000000 + now.tv_nsec - gpio->lastEdgeTimestamp()) / 1000;
+            out << "line " << line << " : " << (on ? "on" : "off") << ", delivered " << delay << " us after the edge\n";
+            out.flush();
+        });
+    }
+
+    return app.exec();
+}
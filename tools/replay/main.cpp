@@ -0,0 +1,209 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTextStream>
+#include <QtSql>
+#include <QtDebug>
+#include <algorithm>
+
+#include "cowdetector.h"
+#include "cowbox.h"
+#include "boxmanager.h"
+#include "debugdetector.h"
+#include "consumptionledger.h"
+#include "allocationcache.h"
+#include "simulatedclock.h"
+
+/*
+ * Replays past cow visits from the meals table through real boxes with simulated hardware,
+ * on a simulated clock so days run in seconds. Nothing is written to the database.
+ *   cowdetector-replay --from 2024-01-01 --to 2024-01-08 [--config cowdetector.json]
+ * Allocations and box parameters are the current ones, so the report shows what the
+ * current code and settings would have given to the same visits.
+ */
+
+struct ReplayEvent {
+    qint64 time;
+    int box;
+    QString rfid;
+    bool entry;
+};
+
+struct CowReport {
+    qreal historicalA = 0.0;
+    qreal historicalB = 0.0;
+    qreal replayedA = 0.0;
+    qreal replayedB = 0.0;
+};
+
+struct BoxReport {
+    int visits = 0;
+    qint64 occupied = 0;            // ms
+};
+
+static bool verbose = false;
+
+static void replayMsgHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+    Q_UNUSED(context);
+    if (type == QtDebugMsg && !verbose) return;
+    QTextStream(stderr) << msg << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays past meals through the feeding code.");
+    parser.addHelpOption();
+    QCommandLineOption configOption("config", "Configuration file.", "file", "cowdetector.json");
+    QCommandLineOption fromOption("from", "First day replayed (yyyy-MM-dd), yesterday by default.", "date");
+    QCommandLineOption toOption("to", "Day after the last one replayed (yyyy-MM-dd), one day after from by default.", "date");
+    QCommandLineOption verboseOption("verbose", "Show box debug messages.");
+    parser.addOptions({configOption, fromOption, toOption, verboseOption});
+    parser.process(app);
+    verbose = parser.isSet(verboseOption);
+    qInstallMessageHandler(replayMsgHandler);
+
+    QFile configFile(parser.value(configOption));
+    if (!configFile.open(QIODevice::ReadOnly)) {
+        qWarning() << "Error opening configuration file : " << configFile.fileName();
+        return -1;
+    }
+    QJsonObject config = QJsonDocument::fromJson(configFile.readAll()).object();
+
+    QDate fromDate = parser.isSet(fromOption) ? QDate::fromString(parser.value(fromOption), Qt::ISODate) : QDate::currentDate().addDays(-1);
+    QDate toDate = parser.isSet(toOption) ? QDate::fromString(parser.value(toOption), Qt::ISODate) : fromDate.addDays(1);
+    if (!fromDate.isValid() || !toDate.isValid() || toDate <= fromDate) {
+        qWarning() << "Invalid replay period.";
+        return -1;
+    }
+    QDateTime from(fromDate, QTime(0, 0));
+    QDateTime to(toDate, QTime(0, 0));
+
+    // Same code as the barn, with simulated hardware, time and no write at all
+    SimulatedClock clock(from);
+    Clock::setInstance(&clock);
+    config.insert("simulation", true);
+    config.insert("readOnly", true);
+    config.insert("boxThreads", 0);
+    config.insert("statementReportInterval", 0);
+    config.insert("deferredDatabase", false);
+    config.insert("snapshotFile", QString());
+    config.insert("stateDirectory", QString());
+    CowDetector* detector = CowDetector::firstInstance(config);
+    QSqlDatabase db = QSqlDatabase::database();
+    if (!db.isOpen()) {
+        qWarning() << "Database not reachable, nothing to replay.";
+        return -1;
+    }
+
+    // Cows are detected by their tag
+    QHash<int, QString> tags;
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT rfid, cownumber FROM identification WHERE cownumber IS NOT NULL")) {
+        qWarning() << "identification table query error : " << query.lastError().text();
+        return -1;
+    }
+    while (query.next()) tags.insert(query.value(1).toInt(), query.value(0).toString());
+
+    // Entry and exit events of the period
+    QVector<ReplayEvent> events;
+    QMap<int, CowReport> cows;
+    QMap<int, BoxReport> boxes;
+    query.prepare("SELECT cow, box, entry, exit, fooda, foodb FROM meals WHERE entry >= :from AND entry < :to ORDER BY entry");
+    query.bindValue(":from", from);
+    query.bindValue(":to", to);
+    if (!query.exec()) {
+        qWarning() << "meals query error : " << query.lastError().text();
+        return -1;
+    }
+    while (query.next()) {
+        int cow = query.value(0).toInt();
+        int box = query.value(1).toInt();
+        if (!tags.contains(cow)) continue;
+        qint64 entry = query.value(2).toDateTime().toMSecsSinceEpoch();
+        qint64 exit = qMax(entry, query.value(3).isNull() ? entry : query.value(3).toDateTime().toMSecsSinceEpoch());
+        events.append({entry, box, tags.value(cow), true});
+        events.append({exit, box, tags.value(cow), false});
+        cows[cow].historicalA += query.value(4).toReal();
+        cows[cow].historicalB += query.value(5).toReal();
+        boxes[box].visits++;
+        boxes[box].occupied += exit - entry;
+    }
+    std::stable_sort(events.begin(), events.end(), [](const ReplayEvent &a, const ReplayEvent &b) {
+        return a.time < b.time || (a.time == b.time && !a.entry && b.entry);
+    });
+    qDebug() << "Replaying" << events.count() << "events on" << boxes.count() << "boxes from" << from << "to" << to;
+
+    // One box per box number found in the period
+    QJsonArray boxArray;
+    for (int box : boxes.keys()) {
+        QJsonObject boxConfig;
+        boxConfig.insert("id", box);
+        boxConfig.insert("name", QString("Box %1").arg(box));
+        boxArray.append(boxConfig);
+    }
+    config.insert("boxes", boxArray);
+    BoxManager* boxManager = new BoxManager(config);
+    QHash<int, DebugDetector*> detectors;
+    for (int i = 0; i < boxManager->boxes().count(); i++) {
+        detectors.insert(boxArray.at(i).toObject().value("id").toInt(), qobject_cast<DebugDetector*>(boxManager->boxes().at(i)->rfid()));
+    }
+
+    QObject::connect(detector->ledger(), &ConsumptionLedger::dispensed, [&cows](int cow, const QDateTime &mealEntry, qreal foodA, qreal foodB) {
+        Q_UNUSED(mealEntry);
+        cows[cow].replayedA += foodA;
+        cows[cow].replayedB += foodB;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    for (const ReplayEvent &event : events) {
+        clock.advance(event.time - clock.now().toMSecsSinceEpoch());
+        DebugDetector* reader = detectors.value(event.box);
+        if (event.entry) reader->setDetected(event.rfid);
+        else if (reader->id() == event.rfid) reader->setDetected(QString());      // A new cow may already be in
+    }
+    clock.advanceTo(to);
+    qint64 elapsed = qMax(qint64(1), timer.elapsed());
+
+    // Report
+    QTextStream out(stdout);
+    int days = from.daysTo(to);
+    out << "Replayed " << events.count() << " events in " << elapsed << " ms : " << qRound64(events.count() * 1000.0 / elapsed)
+        << " events/s, " << qRound64(from.msecsTo(to) / qreal(elapsed)) << "x real time\n\n";
+
+    out << "box    visits  occupancy\n";
+    for (auto i = boxes.constBegin(); i != boxes.constEnd(); i++) {
+        out.setFieldAlignment(QTextStream::AlignLeft);
+        out << qSetFieldWidth(6) << i.key() << qSetFieldWidth(0) << " ";
+        out.setFieldAlignment(QTextStream::AlignRight);
+        out << qSetFieldWidth(7) << i.value().visits << qSetFieldWidth(0)
+            << "  " << QString::number(100.0 * i.value().occupied / from.msecsTo(to), 'f', 1) << " %\n";
+    }
+
+    out << "\ncow    allocated A/B      historical A/B     replayed A/B       replayed/allocated\n";
+    AllocationCache* allocations = detector->allocations();
+    out.setFieldAlignment(QTextStream::AlignLeft);
+    for (auto i = cows.constBegin(); i != cows.constEnd(); i++) {
+        FoodAllocation allocation;
+        allocations->allocation(i.key(), &allocation);
+        qreal allocated = qreal(allocation.foodA + allocation.foodB) * days;
+        qreal replayed = i.value().replayedA + i.value().replayedB;
+        out << qSetFieldWidth(6) << i.key() << qSetFieldWidth(0)
+            << " " << qSetFieldWidth(18) << QString("%1 / %2").arg(allocation.foodA * days).arg(allocation.foodB * days)
+            << " " << QString("%1 / %2").arg(qRound64(i.value().historicalA)).arg(qRound64(i.value().historicalB))
+            << " " << QString("%1 / %2").arg(qRound64(i.value().replayedA)).arg(qRound64(i.value().replayedB)) << qSetFieldWidth(0)
+            << " " << (allocated > 0 ? QString::number(100.0 * replayed / allocated, 'f', 1) + " %" : QString("-")) << "\n";
+    }
+
+    delete boxManager;
+    CowDetector::deleteCowDetector();
+    Clock::setInstance(nullptr);
+    return 0;
+}
@@ -0,0 +1,12 @@
+QT += core sql serialport
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = cowdetector-replay
+TEMPLATE = app
+
+include(../../cowdetector.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,87 @@
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QTextStream>
+#include <QTimer>
+#include <QVector>
+
+#include <unistd.h>
+#include <pty.h>
+
+/*
+ * Pseudo-terminals standing in for Innovation readers, to run the RFID I/O service without hardware.
+ *   rfidpty [readers] [frame interval ms] [garbage percent]
+ * Prints the "boxes" to paste in cowdetector.json (with "rfidIoService": true), then each reader
+ * sees random cows for some seconds, repeating the tag frame like a reader does while the tag is in range.
+ * Some frames are corrupted or preceded by noise to exercise the parser error paths.
+ */
+
+struct Reader {
+    int master = -1;
+    QByteArray tag;                         // Empty when no cow
+    int remaining = 0;                      // Frames until the cow leaves or comes
+};
+
+static QByteArray frame(const QByteArray &tag)
+{
+    static const char Hex[] = "0123456789ABCDEF";
+    int checksum = 0;
+    for (int i = 0; i < tag.size(); i += 2) checksum ^= tag.mid(i, 2).toInt(nullptr, 16);
+    return '\x02' + tag + Hex[checksum >> 4] + Hex[checksum & 0x0F] + "\r\n\x03";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QStringList arguments = app.arguments();
+    int count = arguments.value(1, "8").toInt();
+    int interval = arguments.value(2, "100").toInt();
+    int garbage = arguments.value(3, "1").toInt();
+    QTextStream out(stdout);
+    QRandomGenerator random(1);
+
+    QVector<Reader> readers(count);
+    QJsonArray boxes;
+    for (int i = 0; i < count; i++) {
+        int slave;
+        char name[64];
+        if (openpty(&readers[i].master, &slave, name, nullptr, nullptr) < 0) {
+            out << "openpty failed\n";
+            return 1;
+        }
+        // The slave stays open here, so frames are still written while the daemon is restarted
+        QJsonObject detector;
+        detector.insert("type", "InnovationReader");
+        detector.insert("port", QString::fromLatin1(name));
+        QJsonObject box;
+        box.insert("id", 100 + i);
+        box.insert("name", QString("Pty box %1").arg(i + 1));
+        box.insert("detector", detector);
+        boxes.append(box);
+    }
+    out << QJsonDocument(QJsonObject{{ "boxes", boxes }}).toJson() << "\n";
+    out.flush();
+
+    QTimer timer;
+    timer.setInterval(interval);
+    QObject::connect(&timer, &QTimer::timeout, [&]() {
+        for (Reader &reader : readers) {
+            if (reader.remaining-- <= 0) {
+                // A cow comes in for a few seconds, or the box stays empty for a while
+                if (reader.tag.isEmpty()) reader.tag = QByteArray::number(0x1000000000ull | random.bounded(0x10000000u), 16).toUpper();
+                else reader.tag.clear();
+                reader.remaining = random.bounded(20, 200);
+            }
+            if (reader.tag.isEmpty()) continue;
+
+            QByteArray data = frame(reader.tag);
+            if (random.bounded(100) < garbage) data.prepend(QByteArray(random.bounded(1, 20), char(random.bounded(256))));
+            if (random.bounded(100) < garbage) data[random.bounded(1, 11)] = 'G';
+            if (write(reader.master, data.constData(), size_t(data.size())) < 0) continue;
+        }
+    });
+    timer.start();
+    return app.exec();
+}
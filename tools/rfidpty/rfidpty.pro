@@ -0,0 +1,12 @@
+QT += core
+QT -= gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = rfidpty
+TEMPLATE = app
+
+LIBS += -lutil
+
+SOURCES += main.cpp
@@ -0,0 +1,203 @@
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QVector>
+#include <QtDebug>
+
+#ifndef Q_OS_WIN
+#include <signal.h>
+#endif
+
+#include "signalnotifier.h"
+
+/*
+ * Each thread records in its own ring of fixed size, the oldest events are overwritten.
+ * Rings are only read when writing the file : recording is stopped and the writer waits for
+ * the events being recorded, so no event is read while it is written.
+ * When tracing is off a span costs one relaxed atomic load.
+ */
+
+struct TraceEvent {
+    const char* name;
+    const char* detail;
+    qint64 start;
+    qint64 duration;                        // -1 for instant events
+};
+
+struct TraceBuffer {
+    QVector<TraceEvent> events;
+    std::atomic<quint64> head{0};
+    QString threadName;
+    int threadId;
+};
+
+std::atomic<bool> Tracer::m_enabled(false);
+Tracer* Tracer::m_instance = nullptr;
+
+static QMutex buffersMutex;
+static QList<TraceBuffer*> buffers;         // Kept to the end, threads may come and go
+static int bufferSize = 16384;
+static thread_local TraceBuffer* threadBuffer = nullptr;
+static std::atomic<bool> paused{false};     // Set while the file is written
+static std::atomic<int> recorders{0};       // Threads inside record, counted before they check paused
+static QMutex writeMutex;
+static QMutex internMutex;
+static QSet<QByteArray> interned;
+
+static TraceBuffer* currentBuffer()
+{
+    if (threadBuffer) return threadBuffer;
+    TraceBuffer* buffer = new TraceBuffer;
+    QMutexLocker locker(&buffersMutex);
+    buffer->events.resize(bufferSize);
+    buffer->threadId = buffers.count() + 1;
+    buffer->threadName = QThread::currentThread()->objectName();
+    if (buffer->threadName.isEmpty()) buffer->threadName = QThread::currentThread() == QCoreApplication::instance()->thread() ? "main" : QString("thread %1").arg(buffer->threadId);
+    buffers.append(buffer);
+    threadBuffer = buffer;
+    return buffer;
+}
+
+static void record(const char *name, const char *detail, qint64 start, qint64 duration)
+{
+    // Sequentially consistent with the stop in write, either the writer waits for us or we see the stop
+    recorders.fetch_add(1);
+    if (paused.load()) {
+        recorders.fetch_sub(1);
+        return;
+    }
+    TraceBuffer* buffer = currentBuffer();
+    quint64 head = buffer->head.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[int(head % quint64(buffer->events.size()))];
+    event.name = name;
+    event.detail = detail;
+    event.start = start;
+    event.duration = duration;
+    buffer->head.store(head + 1, std::memory_order_release);
+    recorders.fetch_sub(1);
+}
+
+Tracer::Tracer(const QJsonObject &config, QObject *parent) :
+    QObject(parent)
+  , m_fileName(config.value("traceFile").toString("cowdetector-trace.json"))
+{
+    bufferSize = qMax(256, config.value("traceBufferSize").toInt(16384));
+
+#ifndef Q_OS_WIN
+    // The toggle is done by the main loop
+    connect(new SignalNotifier(SIGUSR1, this), &SignalNotifier::activated, this, &Tracer::signalReceived);
+#endif
+}
+
+void Tracer::install(const QJsonObject &config)
+{
+    if (m_instance) return;
+    m_instance = new Tracer(config);
+    if (config.value("trace").toBool(false)) setEnabled(true);
+}
+
+void Tracer::uninstall()
+{
+    if (!m_instance) return;
+    if (isEnabled()) setEnabled(false);
+    delete m_instance;
+    m_instance = nullptr;
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+    if (enabled == isEnabled()) return;
+    m_enabled.store(enabled, std::memory_order_relaxed);
+    qDebug() << "[Tracer] Tracing " << (enabled ? "started." : "stopped.");
+    if (!enabled && m_instance) write(m_instance->m_fileName);
+}
+
+const char* Tracer::intern(const QString &text)
+{
+    QByteArray bytes = text.toUtf8();
+    QMutexLocker locker(&internMutex);
+    auto i = interned.constFind(bytes);
+    if (i == interned.constEnd()) i = interned.insert(bytes);
+    return i->constData();
+}
+
+void Tracer::complete(const char *name, const char *detail, qint64 start, qint64 duration)
+{
+    record(name, detail, start, duration);
+}
+
+void Tracer::instant(const char *name, const char *detail)
+{
+    if (isEnabled()) record(name, detail, now(), -1);
+}
+
+qint64 Tracer::now()
+{
+    static const QElapsedTimer reference = []() { QElapsedTimer timer; timer.start(); return timer; }();
+    return reference.nsecsElapsed() / 1000;
+}
+
+static QByteArray jsonString(const char *text)
+{
+    QByteArray escaped;
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') escaped += '\\';
+        if (uchar(*c) < 0x20) escaped += ' ';
+        else escaped += *c;
+    }
+    return '"' + escaped + '"';
+}
+
+bool Tracer::write(const QString &fileName)
+{
+    // Events of the dump are lost, none is read half written
+    QMutexLocker writeLocker(&writeMutex);
+    paused.store(true);
+    while (recorders.load() > 0) QThread::yieldCurrentThread();
+    bool written = writeBuffers(fileName);
+    paused.store(false);
+    return written;
+}
+
+bool Tracer::writeBuffers(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "[Tracer] Can't write " << fileName << file.errorString();
+        return false;
+    }
+
+    qint64 pid = QCoreApplication::applicationPid();
+    int count = 0;
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    QMutexLocker locker(&buffersMutex);
+    for (TraceBuffer* buffer : buffers) {
+        QByteArray thread = QString(",\"pid\":%1,\"tid\":%2").arg(pid).arg(buffer->threadId).toLatin1();
+        file.write((count++ ? ",\n" : "") + QByteArray("{\"name\":\"thread_name\",\"ph\":\"M\"") + thread
+                   + ",\"args\":{\"name\":" + jsonString(buffer->threadName.toUtf8().constData()) + "}}");
+
+        quint64 head = buffer->head.load(std::memory_order_acquire);
+        quint64 size = quint64(buffer->events.size());
+        for (quint64 i = head > size ? head - size : 0; i < head; i++) {
+            const TraceEvent &event = buffer->events.at(int(i % size));
+            QByteArray line = ",\n{\"name\":" + jsonString(event.name) + thread + ",\"ts\":" + QByteArray::number(event.start);
+            if (event.duration >= 0) line += ",\"ph\":\"X\",\"dur\":" + QByteArray::number(event.duration);
+            else line += ",\"ph\":\"i\",\"s\":\"t\"";
+            if (event.detail) line += ",\"args\":{\"detail\":" + jsonString(event.detail) + "}";
+            file.write(line + "}");
+        }
+    }
+    file.write("\n]}\n");
+    qDebug() << "[Tracer] Trace written to " << fileName;
+    return true;
+}
+
+void Tracer::signalReceived()
+{
+    setEnabled(!isEnabled());
+}
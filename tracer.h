@@ -0,0 +1,61 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <atomic>
+
+// Spans of the detection to dispense path, written as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Off by default, "trace": true in the configuration or SIGUSR1 starts it, SIGUSR1 again writes "traceFile".
+class Tracer : public QObject
+{
+    Q_OBJECT
+public:
+    static void install(const QJsonObject &config);
+    static void uninstall();
+
+    static bool isEnabled() { return m_enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enabled);
+
+    // Names and details must outlive the tracer, string literals or interned strings
+    static const char* intern(const QString &text);
+    static void complete(const char *name, const char *detail, qint64 start, qint64 duration);
+    static void instant(const char *name, const char *detail = nullptr);
+
+    // Microseconds of the trace clock
+    static qint64 now();
+
+    static bool write(const QString &fileName);
+
+private:
+    explicit Tracer(const QJsonObject &config, QObject *parent = 0);
+    static bool writeBuffers(const QString &fileName);
+
+private slots:
+    void signalReceived();
+
+private:
+    static std::atomic<bool> m_enabled;
+    static Tracer* m_instance;
+    QString m_fileName;
+};
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name, const char *detail = nullptr) :
+        m_name(name), m_detail(detail), m_start(Tracer::isEnabled() ? Tracer::now() : -1) {}
+    ~TraceScope() { if (m_start >= 0) Tracer::complete(m_name, m_detail, m_start, Tracer::now() - m_start); }
+
+private:
+    Q_DISABLE_COPY(TraceScope)
+    const char* m_name;
+    const char* m_detail;
+    qint64 m_start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
+
+#endif // TRACER_H